@@ -2,6 +2,12 @@
 #include <cppad/cppad.hpp>
 #include <cppad/ipopt/solve.hpp>
 #include "Eigen-3.3/Eigen/Core"
+#include "lm.h"
+#include "model.h"
+#include "problem.h"
+#include "profiler.h"
+#include "rti.h"
+#include "structure.h"
 
 using CppAD::AD;
 
@@ -25,62 +31,46 @@ using CppAD::AD;
  Calculation horizon N was reduced to 10 and delta t was increased to 0.1 from
  values used in the quizz to speed up the calculations.
  */
-size_t N =  10;
-double dt = 0.1;
-
-// This value assumes the model presented in the classroom is used.
-//
-// This is the length from front to CoG that has a similar radius.
-const double Lf = 2.67;
-
-// Both the reference cross track and orientation errors are 0.
-// The reference velocity is set to 20 mph.
-double ref_v = 40 * 0.44704;
-
-
-// The solver takes all the state variables and actuator
-// variables in a singular vector. Thus, we should to establish
-// when one variable starts and another ends to make our lifes easier.
-size_t x_start = 0;
-size_t y_start = x_start + N;
-size_t psi_start = y_start + N;
-size_t v_start = psi_start + N;
-size_t cte_start = v_start + N;
-size_t epsi_start = cte_start + N;
-size_t delta_start = epsi_start + N;
-size_t a_start = delta_start + N - 1;
 
+// Objective and constraints for Ipopt. CppAD tapes this and differentiates
+// the whole of it on every Jacobian and Hessian evaluation, constant
+// entries included. Filling the constant cost Hessian and linear dynamics
+// entries once would need a hand-written Ipopt::TNLP in place of
+// CppAD::ipopt::solve, which has not been done; only RTI and LM reuse
+// their constant blocks (structure.h).
 class FG_eval {
  public:
   // Fitted polynomial coefficients
   Eigen::VectorXd coeffs;
-  FG_eval(Eigen::VectorXd coeffs) { this->coeffs = coeffs; }
+  FG_eval(Eigen::VectorXd coeffs, const VarIndex& idx, const MPCConfig& config,
+          const Eigen::MatrixXd& terminal, const Eigen::VectorXd& state)
+      : idx(idx), N(config.N), dt(config.dt), integrator(config.integrator),
+        formulation(config.formulation), terminal(terminal), state(state) {
+    this->coeffs = coeffs;
+  }
 
   typedef CPPAD_TESTVECTOR(AD<double>) ADvector;
   void operator()(ADvector& fg, const ADvector& vars) {
+    // Called on AD variables while CppAD records the tape.
+    StageScope stage(Stage::TAPING);
+    if (formulation == Formulation::REDUCED) {
+      reduced(fg, vars);
+      return;
+    }
+    if (formulation == Formulation::SINGLE_SHOOTING) {
+      shooting(fg, vars);
+      return;
+    }
     // `fg` a vector of the cost constraints, `vars` is a vector of variable values (state & actuators)
     // The cost is stored is the first element of `fg`.
     // Any additions to the cost should be added to `fg[0]`.
-    fg[0] = 0;
-
-    // The part of the cost based on the reference state.
+    std::vector<AD<double>> cte(N), epsi(N), v(N);
     for (size_t t = 0; t < N; t++) {
-      fg[0] += CppAD::pow(vars[cte_start + t], 2);
-      fg[0] += 200 * CppAD::pow(vars[epsi_start + t], 2);
-      fg[0] += CppAD::pow(vars[v_start + t] - ref_v, 2);
-    }
-
-    // Minimize the use of actuators.
-    for (size_t t = 0; t < N - 1; t++) {
-      fg[0] += CppAD::pow(vars[delta_start + t], 2);
-      fg[0] += CppAD::pow(vars[a_start + t], 2);
-    }
-
-    // Minimize the value gap between sequential actuations.
-    for (size_t t = 0; t < N - 2; t++) {
-      fg[0] += 1000 * CppAD::pow(vars[delta_start + t + 1] - vars[delta_start + t], 2);
-      fg[0] += CppAD::pow(vars[a_start + t + 1] - vars[a_start + t], 2);
+      cte[t] = vars[idx.cte(t)];
+      epsi[t] = vars[idx.epsi(t)];
+      v[t] = vars[idx.v(t)];
     }
+    fg[0] = cost(vars, cte, epsi, v);
 
     //
     // Setup Constraints
@@ -89,70 +79,269 @@ class FG_eval {
 
     // Initial constraints
     //
-    // We add 1 to each of the starting indices due to cost being located at
+    // We add 1 to each of the constraint rows due to cost being located at
     // index 0 of `fg`.
     // This bumps up the position of all the other values.
-    fg[1 + x_start] = vars[x_start];
-    fg[1 + y_start] = vars[y_start];
-    fg[1 + psi_start] = vars[psi_start];
-    fg[1 + v_start] = vars[v_start];
-    fg[1 + cte_start] = vars[cte_start];
-    fg[1 + epsi_start] = vars[epsi_start];
+    fg[1 + idx.row(0, 0)] = vars[idx.x(0)];
+    fg[1 + idx.row(1, 0)] = vars[idx.y(0)];
+    fg[1 + idx.row(2, 0)] = vars[idx.psi(0)];
+    fg[1 + idx.row(3, 0)] = vars[idx.v(0)];
+    fg[1 + idx.row(4, 0)] = vars[idx.cte(0)];
+    fg[1 + idx.row(5, 0)] = vars[idx.epsi(0)];
 
     // The rest of the constraints
     for (size_t t = 1; t < N; t++) {
       // The state at time t+1 .
-      AD<double> x1 = vars[x_start + t];
-      AD<double> y1 = vars[y_start + t];
-      AD<double> psi1 = vars[psi_start + t];
-      AD<double> v1 = vars[v_start + t];
-      AD<double> cte1 = vars[cte_start + t];
-      AD<double> epsi1 = vars[epsi_start + t];
+      AD<double> x1 = vars[idx.x(t)];
+      AD<double> y1 = vars[idx.y(t)];
+      AD<double> psi1 = vars[idx.psi(t)];
+      AD<double> v1 = vars[idx.v(t)];
+      AD<double> cte1 = vars[idx.cte(t)];
+      AD<double> epsi1 = vars[idx.epsi(t)];
 
       // The state at time t.
-      AD<double> x0 = vars[x_start + t - 1];
-      AD<double> y0 = vars[y_start + t - 1];
-      AD<double> psi0 = vars[psi_start + t - 1];
-      AD<double> v0 = vars[v_start + t - 1];
-      AD<double> cte0 = vars[cte_start + t - 1];
-      AD<double> epsi0 = vars[epsi_start + t - 1];
+      AD<double> x0 = vars[idx.x(t - 1)];
+      AD<double> y0 = vars[idx.y(t - 1)];
+      AD<double> psi0 = vars[idx.psi(t - 1)];
+      AD<double> v0 = vars[idx.v(t - 1)];
+      AD<double> cte0 = vars[idx.cte(t - 1)];
+      AD<double> epsi0 = vars[idx.epsi(t - 1)];
 
       // Only consider the actuation at time t.
-      AD<double> delta0 = vars[delta_start + t - 1];
-      AD<double> a0 = vars[a_start + t - 1];
-
-      AD<double> f0 = coeffs[0] + coeffs[1] * x0 + coeffs[2] * CppAD::pow(x0, 2) + coeffs[3] * CppAD::pow(x0, 3);
-      AD<double> psides0 = CppAD::atan(coeffs[1] + 2 * coeffs[2] * x0 + 3 * coeffs[3] * CppAD::pow(x0, 2));
-
-      // x_[t+1] = x[t] + v[t] * cos(psi[t]) * dt
-      // y_[t+1] = y[t] + v[t] * sin(psi[t]) * dt
-      // psi_[t+1] = psi[t] + v[t] / Lf * delta[t] * dt
-      // v_[t+1] = v[t] + a[t] * dt
-      // cte[t+1] = f(x[t]) - y[t] + v[t] * sin(epsi[t]) * dt
-      // epsi[t+1] = psi[t] - psides[t] + v[t] * delta[t] / Lf * dt
-      fg[1 + x_start + t] = x1 - (x0 + v0 * CppAD::cos(psi0) * dt);
-      fg[1 + y_start + t] = y1 - (y0 + v0 * CppAD::sin(psi0) * dt);
-      fg[1 + psi_start + t] = psi1 - (psi0 + v0 * delta0 / Lf * dt);
-      fg[1 + v_start + t] = v1 - (v0 + a0 * dt);
-      fg[1 + cte_start + t] =
-          cte1 - ((f0 - y0) + (v0 * CppAD::sin(epsi0) * dt));
-      fg[1 + epsi_start + t] =
-          epsi1 - ((psi0 - psides0) + v0 * delta0 / Lf * dt);
+      AD<double> delta0 = vars[idx.delta(t - 1)];
+      AD<double> a0 = vars[idx.a(t - 1)];
+
+      if (integrator == Integrator::EULER) {
+        AD<double> f0 = coeffs[0] + coeffs[1] * x0 + coeffs[2] * CppAD::pow(x0, 2) + coeffs[3] * CppAD::pow(x0, 3);
+        AD<double> psides0 = CppAD::atan(coeffs[1] + 2 * coeffs[2] * x0 + 3 * coeffs[3] * CppAD::pow(x0, 2));
+
+        // x_[t+1] = x[t] + v[t] * cos(psi[t]) * dt
+        // y_[t+1] = y[t] + v[t] * sin(psi[t]) * dt
+        // psi_[t+1] = psi[t] + v[t] / Lf * delta[t] * dt
+        // v_[t+1] = v[t] + a[t] * dt
+        // cte[t+1] = f(x[t]) - y[t] + v[t] * sin(epsi[t]) * dt
+        // epsi[t+1] = psi[t] - psides[t] + v[t] * delta[t] / Lf * dt
+        fg[1 + idx.row(0, t)] = x1 - (x0 + v0 * CppAD::cos(psi0) * dt);
+        fg[1 + idx.row(1, t)] = y1 - (y0 + v0 * CppAD::sin(psi0) * dt);
+        fg[1 + idx.row(2, t)] = psi1 - (psi0 + v0 * delta0 / Lf * dt);
+        fg[1 + idx.row(3, t)] = v1 - (v0 + a0 * dt);
+        fg[1 + idx.row(4, t)] =
+            cte1 - ((f0 - y0) + (v0 * CppAD::sin(epsi0) * dt));
+        fg[1 + idx.row(5, t)] =
+            epsi1 - ((psi0 - psides0) + v0 * delta0 / Lf * dt);
+      } else {
+        // The higher order integrators propagate x, y, psi and v, and the
+        // errors are measured against the reference at the new state:
+        // cte[t+1] = f(x[t+1]) - y[t+1]
+        // epsi[t+1] = psi[t+1] - atan(f'(x[t+1]))
+        VehicleState<AD<double>> s1 =
+            step(VehicleState<AD<double>>{x0, y0, psi0, v0}, delta0, a0, dt, integrator);
+
+        AD<double> f1 = coeffs[0] + coeffs[1] * s1.x + coeffs[2] * CppAD::pow(s1.x, 2) + coeffs[3] * CppAD::pow(s1.x, 3);
+        AD<double> psides1 = CppAD::atan(coeffs[1] + 2 * coeffs[2] * s1.x + 3 * coeffs[3] * CppAD::pow(s1.x, 2));
+
+        fg[1 + idx.row(0, t)] = x1 - s1.x;
+        fg[1 + idx.row(1, t)] = y1 - s1.y;
+        fg[1 + idx.row(2, t)] = psi1 - s1.psi;
+        fg[1 + idx.row(3, t)] = v1 - s1.v;
+        fg[1 + idx.row(4, t)] = cte1 - (f1 - s1.y);
+        fg[1 + idx.row(5, t)] = epsi1 - (s1.psi - psides1);
+      }
+    }
+  }
+
+ private:
+  // The cost given the errors and speed of every timestep; the actuations
+  // are variables in every formulation.
+  AD<double> cost(const ADvector& vars, const std::vector<AD<double>>& cte,
+                  const std::vector<AD<double>>& epsi, const std::vector<AD<double>>& v) {
+    AD<double> cost = 0;
+
+    // The part of the cost based on the reference state.
+    for (size_t t = 0; t < N; t++) {
+      cost += w_cte * CppAD::pow(cte[t], 2);
+      cost += w_epsi * CppAD::pow(epsi[t], 2);
+      cost += w_v * CppAD::pow(v[t] - ref_v, 2);
+    }
+
+    // Minimize the use of actuators.
+    for (size_t t = 0; t < N - 1; t++) {
+      cost += w_delta * CppAD::pow(vars[idx.delta(t)], 2);
+      cost += w_a * CppAD::pow(vars[idx.a(t)], 2);
+    }
+
+    // Minimize the value gap between sequential actuations.
+    for (size_t t = 0; t < N - 2; t++) {
+      cost += w_ddelta * CppAD::pow(vars[idx.delta(t + 1)] - vars[idx.delta(t)], 2);
+      cost += w_da * CppAD::pow(vars[idx.a(t + 1)] - vars[idx.a(t)], 2);
+    }
+
+    // Cost-to-go beyond the horizon, z' * terminal * z with
+    // z = [cte, epsi, v - ref_v] at the last timestep.
+    if (terminal.size() > 0) {
+      AD<double> z[3] = {cte[N - 1], epsi[N - 1], v[N - 1] - ref_v};
+      for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+          cost += terminal(i, j) * z[i] * z[j];
+        }
+      }
+    }
+    return cost;
+  }
+
+  // Cross track and orientation error of a state against the reference.
+  AD<double> cte_at(const AD<double>& x, const AD<double>& y) {
+    return coeffs[0] + coeffs[1] * x + coeffs[2] * CppAD::pow(x, 2) + coeffs[3] * CppAD::pow(x, 3) - y;
+  }
+  AD<double> epsi_at(const AD<double>& x, const AD<double>& psi) {
+    return psi - CppAD::atan(coeffs[1] + 2 * coeffs[2] * x + 3 * coeffs[3] * CppAD::pow(x, 2));
+  }
+
+  // Formulation::REDUCED: x, y, psi and v are variables tied by the model,
+  // and the errors are expressions of them.
+  void reduced(ADvector& fg, const ADvector& vars) {
+    std::vector<AD<double>> cte(N), epsi(N), v(N);
+    for (size_t t = 0; t < N; t++) {
+      cte[t] = cte_at(vars[idx.x(t)], vars[idx.y(t)]);
+      epsi[t] = epsi_at(vars[idx.x(t)], vars[idx.psi(t)]);
+      v[t] = vars[idx.v(t)];
+    }
+    fg[0] = cost(vars, cte, epsi, v);
+
+    fg[1 + idx.row(0, 0)] = vars[idx.x(0)];
+    fg[1 + idx.row(1, 0)] = vars[idx.y(0)];
+    fg[1 + idx.row(2, 0)] = vars[idx.psi(0)];
+    fg[1 + idx.row(3, 0)] = vars[idx.v(0)];
+    for (size_t t = 1; t < N; t++) {
+      VehicleState<AD<double>> s1 =
+          step(VehicleState<AD<double>>{vars[idx.x(t - 1)], vars[idx.y(t - 1)],
+                                        vars[idx.psi(t - 1)], vars[idx.v(t - 1)]},
+               vars[idx.delta(t - 1)], vars[idx.a(t - 1)], dt, integrator);
+      fg[1 + idx.row(0, t)] = vars[idx.x(t)] - s1.x;
+      fg[1 + idx.row(1, t)] = vars[idx.y(t)] - s1.y;
+      fg[1 + idx.row(2, t)] = vars[idx.psi(t)] - s1.psi;
+      fg[1 + idx.row(3, t)] = vars[idx.v(t)] - s1.v;
+    }
+  }
+
+  // Formulation::SINGLE_SHOOTING: the states are rolled out from the
+  // initial one, and the cost is the only output.
+  void shooting(ADvector& fg, const ADvector& vars) {
+    std::vector<AD<double>> cte(N), epsi(N), v(N);
+    VehicleState<AD<double>> s = {state[0], state[1], state[2], state[3]};
+    for (size_t t = 0; t < N; t++) {
+      if (t > 0) {
+        s = step(s, vars[idx.delta(t - 1)], vars[idx.a(t - 1)], dt, integrator);
+      }
+      cte[t] = cte_at(s.x, s.y);
+      epsi[t] = epsi_at(s.x, s.psi);
+      v[t] = s.v;
     }
+    fg[0] = cost(vars, cte, epsi, v);
   }
+
+  const VarIndex& idx;
+  size_t N;
+  double dt;
+  Integrator integrator;
+  Formulation formulation;
+  const Eigen::MatrixXd& terminal;
+  // The initial state, for single shooting.
+  const Eigen::VectorXd& state;
 };
 
+bool parse_solver(const std::string& name, Solver& solver) {
+  if (name == "ipopt") {
+    solver = Solver::IPOPT;
+  } else if (name == "rti") {
+    solver = Solver::RTI;
+  } else if (name == "lm") {
+    solver = Solver::LEVENBERG_MARQUARDT;
+  } else {
+    return false;
+  }
+  return true;
+}
+
 //
 // MPC class definition implementation.
 //
-MPC::MPC() {}
+MPC::MPC(const MPCConfig& config) : MPC(ProblemStructure::get(config), config.verbose) {}
+
+MPC::MPC(std::shared_ptr<const ProblemStructure> structure, bool verbose)
+    : structure(structure), config(structure->config), verbose(verbose) {
+  if (config.solver == Solver::RTI) {
+    rti.reset(new RTISolver(*structure));
+  } else if (config.solver == Solver::LEVENBERG_MARQUARDT) {
+    lm.reset(new LMSolver(*structure));
+  }
+}
 MPC::~MPC() {}
 
-vector<double> MPC::Solve(Eigen::VectorXd state, Eigen::VectorXd coeffs) {
+void MPC::Reset() {
+  stats = SolveStats();
+  seeded = false;
+  if (rti) {
+    rti->Reset();
+  }
+  if (lm) {
+    lm->Reset();
+  }
+}
+
+void MPC::Seed(const MPC& nominal) {
+  stats = SolveStats();
+  if (rti) {
+    rti->Seed(*nominal.rti);
+  }
+  if (lm) {
+    lm->Seed(*nominal.lm);
+  }
+  seeded = true;
+}
+
+vector<double> MPC::Solve(Eigen::VectorXd state, Eigen::VectorXd coeffs, double elapsed) {
+  auto now = std::chrono::steady_clock::now();
+  if (elapsed < 0) {
+    elapsed = seeded ? 0 : std::chrono::duration<double>(now - last_solve).count();
+  }
+  last_solve = now;
+  seeded = false;
+
+  if (rti) {
+    StageScope stage(Stage::RTI);
+    auto result = rti->Solve(state, coeffs, elapsed);
+    stats.cost = rti->cost();
+    stats.stages_linearised = rti->linearisations().evaluated();
+    stats.stages_reused = rti->linearisations().reused();
+    stats.kkt_iterations = rti->kkt_iterations();
+    if (verbose) {
+      std::cout << "Cost " << stats.cost << ", linearised "
+                << stats.stages_linearised << " of " << config.N - 1
+                << " stages" << std::endl;
+    }
+    return result;
+  }
+  if (lm) {
+    StageScope stage(Stage::LM);
+    auto result = lm->Solve(state, coeffs, elapsed);
+    stats.cost = lm->cost();
+    stats.lm_iterations = lm->iterations();
+    if (verbose) {
+      std::cout << "Cost " << stats.cost << ", " << lm->iterations() << " iterations in "
+                << lm->rounds() << " rounds" << std::endl;
+    }
+    return result;
+  }
+
   bool ok = true;
   size_t i;
   typedef CPPAD_TESTVECTOR(double) Dvector;
 
+  const size_t N = config.N;
+  // The variables of config.formulation.
+  const VarIndex& idx = structure->nlp_idx;
+
   const double x = state[0];
   const double y = state[1];
   const double psi = state[2];
@@ -166,9 +355,9 @@ vector<double> MPC::Solve(Eigen::VectorXd state, Eigen::VectorXd coeffs) {
   //
   // number of independent variables
   // N timesteps == N - 1 actuations
-  size_t n_vars = N * 6 + (N - 1) * 2;
+  size_t n_vars = idx.n_vars();
   // TODO: Set the number of constraints
-  size_t n_constraints = N * 6;
+  size_t n_constraints = idx.n_constraints();
 
   // Initial value of the independent variables.
   // SHOULD BE 0 besides initial state.
@@ -177,40 +366,26 @@ vector<double> MPC::Solve(Eigen::VectorXd state, Eigen::VectorXd coeffs) {
     vars[i] = 0;
   }
   // Set the initial variable values
-  vars[x_start] = x;
-  vars[y_start] = y;
-  vars[psi_start] = psi;
-  vars[v_start] = v;
-  vars[cte_start] = cte;
-  vars[epsi_start] = epsi;
-
-  Dvector vars_lowerbound(n_vars);
-  Dvector vars_upperbound(n_vars);
-  // TODO: Set lower and upper limits for variables.
-
-  // Set all non-actuators upper and lowerlimits
-  // to the max negative and positive values.
-  for (i = 0; i < delta_start; i++) {
-    vars_lowerbound[i] = -1.0e19;
-    vars_upperbound[i] = 1.0e19;
+  const bool shooting = config.formulation == Formulation::SINGLE_SHOOTING;
+  if (!shooting) {
+    vars[idx.x(0)] = x;
+    vars[idx.y(0)] = y;
+    vars[idx.psi(0)] = psi;
+    vars[idx.v(0)] = v;
   }
-
-  // The upper and lower limits of delta are set to -25 and 25
-  // degrees (values in radians).
-  // NOTE: Feel free to change this to something else.
-  for (i = delta_start; i < a_start; i++) {
-    vars_lowerbound[i] = -0.436332;
-    vars_upperbound[i] = 0.436332;
+  if (config.formulation == Formulation::FULL) {
+    vars[idx.cte(0)] = cte;
+    vars[idx.epsi(0)] = epsi;
   }
 
-  // Acceleration/decceleration upper and lower limits.
-  // NOTE: Feel free to change this to something else.
-  for (i = a_start; i < n_vars; i++) {
-    vars_lowerbound[i] = -1.0;
-    vars_upperbound[i] = 1.0;
+  // Limits of the actuators; the other variables are free.
+  Dvector vars_lowerbound(n_vars);
+  Dvector vars_upperbound(n_vars);
+  for (i = 0; i < n_vars; i++) {
+    vars_lowerbound[i] = structure->vars_lowerbound[i];
+    vars_upperbound[i] = structure->vars_upperbound[i];
   }
 
-
   // Lower and upper limits for the constraints
   // Should be 0 besides initial state.
   Dvector constraints_lowerbound(n_constraints);
@@ -219,68 +394,67 @@ vector<double> MPC::Solve(Eigen::VectorXd state, Eigen::VectorXd coeffs) {
     constraints_lowerbound[i] = 0;
     constraints_upperbound[i] = 0;
   }
-  constraints_lowerbound[x_start] = x;
-  constraints_lowerbound[y_start] = y;
-  constraints_lowerbound[psi_start] = psi;
-  constraints_lowerbound[v_start] = v;
-  constraints_lowerbound[cte_start] = cte;
-  constraints_lowerbound[epsi_start] = epsi;
-
-  constraints_upperbound[x_start] = x;
-  constraints_upperbound[y_start] = y;
-  constraints_upperbound[psi_start] = psi;
-  constraints_upperbound[v_start] = v;
-  constraints_upperbound[cte_start] = cte;
-  constraints_upperbound[epsi_start] = epsi;
+  for (size_t k = 0; k < idx.n_stage_states(); k++) {
+    constraints_lowerbound[idx.row(k, 0)] = state[k];
+    constraints_upperbound[idx.row(k, 0)] = state[k];
+  }
 
   // object that computes objective and constraints
-  FG_eval fg_eval(coeffs);
+  FG_eval fg_eval(coeffs, idx, config, structure->terminal, state);
 
-  //
-  // NOTE: You don't have to worry about these options
-  //
-  // options for IPOPT solver
-  std::string options;
-  // Uncomment this if you'd like more print information
-  options += "Integer print_level  0\n";
-  // NOTE: Setting sparse to true allows the solver to take advantage
-  // of sparse routines, this makes the computation MUCH FASTER. If you
-  // can uncomment 1 of these and see if it makes a difference or not but
-  // if you uncomment both the computation time should go up in orders of
-  // magnitude.
-  options += "Sparse  true        forward\n";
-  options += "Sparse  true        reverse\n";
-  // NOTE: Currently the solver has a maximum time limit of 0.5 seconds.
-  // Change this as you see fit.
-  options += "Numeric max_cpu_time          0.5\n";
+  // options for IPOPT solver, see ProblemStructure
+  const std::string& options = structure->ipopt_options;
 
   // place to return solution
   CppAD::ipopt::solve_result<Dvector> solution;
 
   // solve the problem
-  CppAD::ipopt::solve<Dvector, FG_eval>(
-      options, vars, vars_lowerbound, vars_upperbound, constraints_lowerbound,
-      constraints_upperbound, fg_eval, solution);
+  {
+    StageScope stage(Stage::IPOPT);
+    CppAD::ipopt::solve<Dvector, FG_eval>(
+        options, vars, vars_lowerbound, vars_upperbound, constraints_lowerbound,
+        constraints_upperbound, fg_eval, solution);
+  }
 
   // Check some of the solution values
   ok &= solution.status == CppAD::ipopt::solve_result<Dvector>::success;
+  stats.solved = ok;
 
   // Cost
   auto cost = solution.obj_value;
-  std::cout << "Cost " << cost << std::endl;
+  stats.cost = cost;
+  if (verbose) {
+    std::cout << "Cost " << cost << std::endl;
+  }
 
   vector<double> result;
 
   // Return the first actuator values. 
-  result.push_back(solution.x[delta_start]);
-  result.push_back(solution.x[a_start]);
+  result.push_back(solution.x[idx.delta(0)]);
+  result.push_back(solution.x[idx.a(0)]);
 
   // Return the predicted path 
+  if (shooting) {
+    // No state variables: roll the solution out again.
+    std::vector<double> deltas(N - 1), as(N - 1);
+    for (size_t t = 0; t < N - 1; t++) {
+      deltas[t] = solution.x[idx.delta(t)];
+      as[t] = solution.x[idx.a(t)];
+    }
+    auto path = rollout(VehicleState<double>{x, y, psi, v}, deltas, as, config.dt,
+                        config.integrator);
+    for (size_t i = 0; i < N-1; i++)
+      result.push_back(path[i + 1].x);
+    for (size_t i = 0; i < N-1; i++)
+      result.push_back(path[i + 1].y);
+    return result;
+  }
+
   for (size_t i = 0; i < N-1; i++)
-    result.push_back(solution.x[x_start + i + 1]);
+    result.push_back(solution.x[idx.x(i + 1)]);
 
   for (size_t i = 0; i < N-1; i++)
-    result.push_back(solution.x[y_start + i + 1]);
+    result.push_back(solution.x[idx.y(i + 1)]);
 
   return result;
 }
@@ -1,20 +1,179 @@
 #ifndef MPC_H
 #define MPC_H
 
+#include <chrono>
+#include <memory>
+#include <string>
 #include <vector>
 #include "Eigen-3.3/Eigen/Core"
+#include "model.h"
 
 using namespace std;
 
+// Order of the state and actuator variables in the vector handed to the
+// solver.
+enum class Layout {
+  // All x values first, then all y values, and so on up to all a values.
+  VARIABLE_MAJOR,
+  // The 6 states and 2 actuations of each timestep are contiguous, which
+  // keeps the constraint Jacobian and the KKT matrix banded.
+  STAGE_MAJOR
+};
+
+// How each frame's problem is solved.
+enum class Solver {
+  // The full nonlinear problem with Ipopt.
+  IPOPT,
+  // One Gauss-Newton step on the model linearised along the previous
+  // solution (see rti.h). Much cheaper, relies on consecutive frames.
+  RTI,
+  // Augmented Lagrangian with Eigen's Levenberg-Marquardt (see lm.h), warm
+  // started from the previous frame. Needs neither Ipopt nor CppAD.
+  LEVENBERG_MARQUARDT
+};
+
+// The nonlinear problem handed to Ipopt.
+enum class Formulation {
+  // The states of every timestep are variables, tied together by the model
+  // constraints, with cte and epsi as states of their own.
+  FULL,
+  // The same without the cte and epsi variables and constraints: the cost
+  // computes them from x, y and psi, cte = f(x) - y and
+  // epsi = psi - atan(f'(x)). 2 N fewer of each. With the Euler integrator
+  // the errors are then those at the predicted state rather than the
+  // errors propagated with the model, as the other integrators do anyway.
+  REDUCED,
+  // Single shooting: only the 2 (N - 1) actuations are variables, and the
+  // objective rolls the model out from the initial state. No constraints,
+  // but every state depends on all the actuations before it, so the
+  // Hessian is dense and the tape grows with N. The errors are taken at
+  // the predicted state, as in REDUCED.
+  SINGLE_SHOOTING
+};
+
+// Solver from its command line name: "ipopt", "rti" or "lm". False for any
+// other name.
+bool parse_solver(const std::string& name, Solver& solver);
+
+// How RTI solves the linear system of each step.
+enum class KKTSolver {
+  // Sparse LU factorisation of the assembled KKT matrix.
+  SPARSE_LU,
+  // Preconditioned MINRES with stage-by-stage products (see kkt.h). The
+  // work per iteration is linear in N, for horizons of hundreds of stages.
+  MINRES
+};
+
+struct MPCConfig {
+  // Number of timesteps in the horizon and the time between them.
+  size_t N = 10;
+  double dt = 0.1;
+
+  Layout layout = Layout::STAGE_MAJOR;
+
+  // Used for the model constraints and for the latency prediction. The
+  // higher order integrators reach the same accuracy with longer steps,
+  // i.e. fewer of them for the same look-ahead.
+  Integrator integrator = Integrator::EULER;
+
+  // Add the LQR cost-to-go of the final state to the objective, so that a
+  // short horizon behaves like a long one.
+  bool terminal_cost = false;
+
+  Solver solver = Solver::IPOPT;
+
+  // Ipopt only: the formulation of the problem.
+  Formulation formulation = Formulation::FULL;
+
+  // RTI only: a stage's cached linearisation is reused while its operating
+  // point moved by less than this (max over m, rad, m/s and actuations).
+  double relinearise_tolerance = 0.01;
+
+  // RTI only: look the model Jacobians up in a table precomputed over
+  // (psi, v, delta) instead of differentiating the model every time.
+  bool linearisation_table = false;
+
+  // RTI only: the KKT solver, and the relative residual MINRES stops at.
+  KKTSolver kkt_solver = KKTSolver::SPARSE_LU;
+  double kkt_tolerance = 1e-10;
+
+  // Appended to the Ipopt options, so these win over the defaults.
+  std::string ipopt_options;
+
+  // Print the cost of every solve. Not part of the shared structure, see
+  // MPC's constructors.
+  bool verbose = true;
+};
+
+// Figures about the last solve.
+struct SolveStats {
+  double cost = 0;
+
+  // Ipopt only: false when Ipopt did not report success, e.g. ran out of
+  // iterations or found the problem infeasible.
+  bool solved = true;
+
+  // RTI only: stages whose model linearisation was evaluated, and stages
+  // that reused the one cached from the previous frame.
+  size_t stages_linearised = 0;
+  size_t stages_reused = 0;
+
+  // RTI with MINRES only: iterations over all active set passes.
+  size_t kkt_iterations = 0;
+
+  // Levenberg-Marquardt only: iterations over all augmented Lagrangian
+  // rounds.
+  size_t lm_iterations = 0;
+};
+
+class ProblemStructure;
+class RTISolver;
+class LMSolver;
+
+// One controller: the structure shared with every controller of the same
+// configuration (see structure.h) plus its own state between frames.
 class MPC {
  public:
-  MPC();
+  MPC(const MPCConfig& config = MPCConfig());
+
+  // verbose as MPCConfig::verbose, which the structure's key leaves out,
+  // so that controllers that only differ in it share one structure.
+  explicit MPC(std::shared_ptr<const ProblemStructure> structure, bool verbose = false);
 
   virtual ~MPC();
 
   // Solve the model given an initial state and polynomial coefficients.
   // Return the first actuatotions.
-  vector<double> Solve(Eigen::VectorXd state, Eigen::VectorXd coeffs);
+  //
+  // elapsed is the time in seconds since the previous Solve, which RTI and
+  // LM shift their warm start by; negative to take it from the steady
+  // clock, as the servers do with one frame per telemetry message.
+  vector<double> Solve(Eigen::VectorXd state, Eigen::VectorXd coeffs, double elapsed = -1);
+
+  // Start over as a new controller on the same structure, e.g. for the
+  // next vehicle, without giving back any memory.
+  void Reset();
+
+  // Start over from the last frame of nominal, a controller on the same
+  // structure, instead of cold: RTI and LM take its solution as their warm
+  // start, unshifted on the next Solve that does not pass elapsed. Ipopt
+  // keeps nothing between frames, so for it this is Reset().
+  void Seed(const MPC& nominal);
+
+  const SolveStats& LastStats() const { return stats; }
+
+ private:
+  std::shared_ptr<const ProblemStructure> structure;
+  const MPCConfig& config;
+  const bool verbose;
+  SolveStats stats;
+  std::chrono::steady_clock::time_point last_solve;
+  // Seed() since the last Solve.
+  bool seeded = false;
+
+  // Keeps the previous solution and linearisations between frames.
+  std::unique_ptr<RTISolver> rti;
+  std::unique_ptr<LMSolver> lm;
 };
 
 #endif /* MPC_H */
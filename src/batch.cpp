@@ -0,0 +1,57 @@
+#include "batch.h"
+#include "fastmath.h"
+
+namespace {
+
+// Scratch array, reused between calls to avoid allocating every frame.
+thread_local std::vector<double> slopes;
+
+}  // namespace
+
+void step_batch(VehicleBatch& batch, const double* delta, const double* a,
+                double dt, Integrator integrator) {
+  const size_t n = batch.size();
+  double* x = batch.x.data();
+  double* y = batch.y.data();
+  double* psi = batch.psi.data();
+  double* v = batch.v.data();
+
+  // model.h's step(), Pack::width vehicles at a time.
+  size_t i = 0;
+  for (; i + Pack::width <= n; i += Pack::width) {
+    VehicleState<Pack> s = {Pack::load(x + i), Pack::load(y + i), Pack::load(psi + i),
+                            Pack::load(v + i)};
+    s = step(s, Pack::load(delta + i), Pack::load(a + i), dt, integrator);
+    s.x.store(x + i);
+    s.y.store(y + i);
+    s.psi.store(psi + i);
+    s.v.store(v + i);
+  }
+  // The rest one at a time, with the same kernels.
+  for (; i < n; i++) {
+    batch.set(i, step(batch.get(i), delta[i], a[i], dt, integrator));
+  }
+}
+
+void track_errors_batch(const VehicleBatch& batch, const Eigen::VectorXd& coeffs,
+                        double* cte, double* epsi) {
+  const size_t n = batch.size();
+  slopes.resize(n);
+  double* slope = slopes.data();
+  for (size_t i = 0; i < n; i++) {
+    // f(x) and f'(x) by Horner's rule.
+    double x = batch.x[i];
+    double f = 0;
+    double df = 0;
+    for (int k = coeffs.size() - 1; k >= 0; k--) {
+      df = df * x + f;
+      f = f * x + coeffs[k];
+    }
+    cte[i] = f - batch.y[i];
+    slope[i] = df;
+  }
+  fast_atan(slope, epsi, n);
+  for (size_t i = 0; i < n; i++) {
+    epsi[i] = batch.psi[i] - epsi[i];
+  }
+}
@@ -0,0 +1,47 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <vector>
+#include "Eigen-3.3/Eigen/Core"
+#include "model.h"
+
+/*
+ The model of model.h applied to many vehicles at once, e.g. to roll out a
+ set of candidate actuation sequences.
+
+ The states are kept as one array per variable, so that step_batch() can
+ run model.h's step() on a Pack of vehicles at a time, with the vectorised
+ sin and cos of fastmath.h. The track errors take their atan from there
+ too.
+ */
+
+struct VehicleBatch {
+  std::vector<double> x;
+  std::vector<double> y;
+  std::vector<double> psi;
+  std::vector<double> v;
+
+  VehicleBatch(size_t n = 0) : x(n), y(n), psi(n), v(n) {}
+
+  size_t size() const { return x.size(); }
+
+  VehicleState<double> get(size_t i) const { return {x[i], y[i], psi[i], v[i]}; }
+  void set(size_t i, const VehicleState<double>& s) {
+    x[i] = s.x;
+    y[i] = s.y;
+    psi[i] = s.psi;
+    v[i] = s.v;
+  }
+};
+
+// step() for every vehicle, with delta[i] and a[i] held over the step. The
+// same as step() on each vehicle's VehicleState<double>, to the bit.
+void step_batch(VehicleBatch& batch, const double* delta, const double* a,
+                double dt, Integrator integrator);
+
+// cte = f(x) - y and epsi = psi - atan(f'(x)) of every vehicle against the
+// reference polynomial f, as in the MPC constraints.
+void track_errors_batch(const VehicleBatch& batch, const Eigen::VectorXd& coeffs,
+                        double* cte, double* epsi);
+
+#endif /* BATCH_H */
@@ -0,0 +1,1011 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Eigen-3.3/Eigen/Core"
+#include "MPC.h"
+#include "batch.h"
+#include "busy_poll.h"
+#include "fastmath.h"
+#include "helpers.h"
+#include "linearisation.h"
+#include "model.h"
+#include "fleet.h"
+#include "pool.h"
+#include "stats.h"
+#include "structure.h"
+#include "structure_cache.h"
+
+/*
+ Solve benchmark.
+
+ Runs MPC::Solve on a fixed set of synthetic frames and reports the
+ latency of each configuration. The frames look like the ones main.cpp
+ builds from the simulator: the car sits at the origin of its own
+ co-ordinate system and the reference trajectory is a gentle 3rd order
+ polynomial.
+
+ Usage: mpc_bench [--suite name] [--frames K] [--repeats R]
+                  [--confidence c] [--output file] [--N n] [--dt s]
+                  [--integrator euler|rk4|ctr] [--terminal-cost]
+                  [--variable-major] [--reduced] [--single-shooting]
+                  [--ipopt-timing]
+        mpc_bench --compare base candidate [--confidence c]
+
+ Suites (all of them run by default):
+   layout      variable-major vs stage-major decision variables
+   integrator  prediction error of each integrator, and the solve time of
+               Euler against RK4 / constant turn rate with half the steps
+   terminal    a short horizon with and without the LQR terminal cost
+               against a horizon twice as long
+   rti         Ipopt against the real-time iteration in closed loop, with
+               and without reusing linearisations between frames, and with
+               Jacobians from the precomputed table
+   kkt         RTI with the KKT system factorised against MINRES, as N
+               grows over the same look-ahead
+   lm          Ipopt against the augmented Lagrangian Levenberg-Marquardt
+               backend in closed loop, for a few horizons
+   formulation Ipopt on the full problem against the reduced one without
+               cte and epsi variables and against single shooting, as N
+               grows; exits with 1 when Ipopt fails on any frame
+   controllers many RTI controllers on one shared problem structure against
+               one structure each: set-up time and resident memory per
+               controller, and connect/disconnect churn through the pool
+   wakeup      wake-up latency of the event loop on a loopback TCP socket,
+               blocking in poll() against busy-poll spin-then-block and
+               spinning only; run it with a core to spare
+   fastmath    the vectorised sin/cos/atan against libm, and rollouts of
+               the model with them, one vehicle and a batch at a time,
+               against the model with libm; exits with 1 when the
+               trajectories differ by more than 1e-9 m. Build
+               mpc_bench_avx to run it 4 doubles wide
+
+ Every timing is reported without its warm-up, with the mean (outliers
+ left out) and the p99 each followed by its confidence interval, 95% by
+ default; see stats.h. --repeats runs the suites R times, in a new random
+ order each time and with the frames shuffled, and then summarises every
+ configuration over all the runs. --output writes those samples to a file,
+ and --compare reads two such files and says for each configuration
+ whether the mean and the p99 of the candidate are a regression, an
+ improvement or no change at that confidence; it exits with 1 on any
+ regression.
+
+ --ipopt-timing makes Ipopt print its timing statistics after every solve,
+ which splits the time into function evaluations and linear system
+ factorisation.
+ */
+
+struct Frame {
+  Eigen::VectorXd state;
+  Eigen::VectorXd coeffs;
+};
+
+std::vector<Frame> make_frames(size_t count, unsigned seed) {
+  std::mt19937 gen(seed);
+  std::uniform_real_distribution<double> offset(-2.0, 2.0);
+  std::uniform_real_distribution<double> heading(-0.2, 0.2);
+  std::uniform_real_distribution<double> curvature(-2e-3, 2e-3);
+  std::uniform_real_distribution<double> speed(5.0, 25.0);
+
+  std::vector<Frame> frames;
+  for (size_t i = 0; i < count; i++) {
+    Frame f;
+    f.coeffs = Eigen::VectorXd(4);
+    f.coeffs << offset(gen), heading(gen), curvature(gen), curvature(gen) * 1e-2;
+
+    // Same as main.cpp: cte and epsi at the car's position (x = 0).
+    double cte = f.coeffs[0];
+    double epsi = -atan(f.coeffs[1]);
+    f.state = Eigen::VectorXd(6);
+    f.state << 0, 0, 0, speed(gen), cte, epsi;
+    frames.push_back(f);
+  }
+  return frames;
+}
+
+// Wall time of every solve in milliseconds.
+std::vector<double> time_solves(MPC& mpc, const std::vector<Frame>& frames) {
+  std::vector<double> samples;
+  for (const Frame& f : frames) {
+    auto start = std::chrono::steady_clock::now();
+    mpc.Solve(f.state, f.coeffs);
+    auto end = std::chrono::steady_clock::now();
+    samples.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+  }
+  return samples;
+}
+
+// Closed loop on a winding road, processed the way main.cpp does it.
+struct Drive {
+  std::vector<double> samples;
+  double mean_abs_cte = 0;
+  double linearised_per_frame = 0;
+  double reused_per_frame = 0;
+  double kkt_iterations_per_frame = 0;
+  double lm_iterations_per_frame = 0;
+};
+
+double road(double x) { return 8 * sin(x / 40); }
+
+Drive drive(MPC& mpc, size_t n_frames) {
+  const double period = 0.1;
+  VehicleState<double> car = {0, 1.5, 0, 10};
+
+  Drive result;
+  for (size_t i = 0; i < n_frames; i++) {
+    // Waypoints from just behind the car to 50 m ahead, in car co-ordinates.
+    Eigen::VectorXd way_pts_x(6);
+    Eigen::VectorXd way_pts_y(6);
+    for (int k = 0; k < 6; k++) {
+      double x = car.x + 10 * k - 5;
+      auto coord_car = global2car(car.psi, car.x, car.y, x, road(x));
+      way_pts_x(k) = coord_car[0];
+      way_pts_y(k) = coord_car[1];
+    }
+    auto coeffs = polyfit(way_pts_x, way_pts_y, 3);
+    double cte = polyeval(coeffs, 0);
+    double epsi = -atan(coeffs[1]);
+
+    Eigen::VectorXd state(6);
+    state << 0, 0, 0, car.v, cte, epsi;
+
+    auto start = std::chrono::steady_clock::now();
+    auto actuations = mpc.Solve(state, coeffs, period);
+    auto end = std::chrono::steady_clock::now();
+    result.samples.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+
+    result.mean_abs_cte += fabs(cte) / n_frames;
+    result.linearised_per_frame += double(mpc.LastStats().stages_linearised) / n_frames;
+    result.reused_per_frame += double(mpc.LastStats().stages_reused) / n_frames;
+    result.kkt_iterations_per_frame += double(mpc.LastStats().kkt_iterations) / n_frames;
+    result.lm_iterations_per_frame += double(mpc.LastStats().lm_iterations) / n_frames;
+
+    // The simulated car, finely stepped.
+    for (int k = 0; k < 10; k++) {
+      car = step(car, actuations[0], actuations[1], period / 10, Integrator::RK4);
+    }
+  }
+  return result;
+}
+
+// First steering and throttle of every frame.
+// The first actuations of every frame, and in unsolved the number of
+// frames Ipopt did not report success on.
+std::vector<std::vector<double>> first_actuations(MPC& mpc, const std::vector<Frame>& frames,
+                                                  size_t* unsolved = nullptr) {
+  std::vector<std::vector<double>> actuations;
+  for (const Frame& f : frames) {
+    auto result = mpc.Solve(f.state, f.coeffs);
+    actuations.push_back({result[0], result[1]});
+    if (unsolved && !mpc.LastStats().solved) {
+      (*unsolved)++;
+    }
+  }
+  return actuations;
+}
+
+// Mean absolute difference of the steering and throttle commands.
+std::vector<double> actuation_gap(const std::vector<std::vector<double>>& a,
+                                  const std::vector<std::vector<double>>& b) {
+  std::vector<double> gap = {0, 0};
+  for (size_t i = 0; i < a.size(); i++) {
+    gap[0] += fabs(a[i][0] - b[i][0]) / a.size();
+    gap[1] += fabs(a[i][1] - b[i][1]) / a.size();
+  }
+  return gap;
+}
+
+// Every sample set reported, as "suite/name", gathered over the repeats.
+Results results;
+std::string current_suite;
+double confidence = 0.95;
+
+void print_summary(const std::string& name, const Summary& s) {
+  std::cout << name
+            << "  mean " << s.mean << " ms [" << s.mean_interval.low << ", "
+            << s.mean_interval.high << "]"
+            << "  median " << s.median << " ms"
+            << "  p99 " << s.p99 << " ms [" << s.p99_interval.low << ", "
+            << s.p99_interval.high << "]";
+  if (s.outliers > 0) {
+    std::cout << "  outliers " << s.outliers;
+  }
+  std::cout << std::endl;
+}
+
+// The run without its warm-up, summarised with confidence intervals and
+// added to the results.
+void report(const std::string& name, const std::vector<double>& run) {
+  size_t warmup = warmup_length(run);
+  std::vector<double> samples(run.begin() + warmup, run.end());
+  print_summary(name, summarise(samples, confidence));
+  if (warmup > 0) {
+    std::cout << "  warm-up: first " << warmup << " of " << run.size() << " samples dropped"
+              << std::endl;
+  }
+  // The names are padded for alignment; the key is without the padding.
+  std::string key = current_suite + "/";
+  for (char c : name) {
+    if (c != ' ' || (key.back() != ' ' && key.back() != '/')) {
+      key += c;
+    }
+  }
+  if (key.back() == ' ') {
+    key.pop_back();
+  }
+  results[key].insert(results[key].end(), samples.begin(), samples.end());
+}
+
+const char* integrator_name(Integrator integrator) {
+  switch (integrator) {
+    case Integrator::RK4:
+      return "rk4";
+    case Integrator::CONSTANT_TURN_RATE:
+      return "ctr";
+    default:
+      return "euler";
+  }
+}
+
+// Mean position error at the end of a look-ahead of `horizon` seconds
+// against a finely stepped RK4 reference. The actuations change every
+// `hold` seconds so that every dt tested here sees the same inputs.
+double prediction_error(Integrator integrator, double dt, double horizon) {
+  const double hold = 0.2;
+  const size_t substeps = 100;
+  std::mt19937 gen(7);
+  std::uniform_real_distribution<double> steer(-0.436332, 0.436332);
+  std::uniform_real_distribution<double> accel(-1.0, 1.0);
+  std::uniform_real_distribution<double> speed(5.0, 25.0);
+
+  double total = 0;
+  const size_t samples = 100;
+  for (size_t i = 0; i < samples; i++) {
+    size_t n_holds = static_cast<size_t>(horizon / hold + 0.5);
+    std::vector<double> deltas, as;
+    for (size_t k = 0; k < n_holds; k++) {
+      deltas.push_back(steer(gen));
+      as.push_back(accel(gen));
+    }
+    VehicleState<double> initial = {0, 0, 0, speed(gen)};
+
+    // Reference: RK4 with many small steps.
+    VehicleState<double> ref = initial;
+    for (size_t k = 0; k < n_holds; k++) {
+      for (size_t j = 0; j < substeps; j++) {
+        ref = step(ref, deltas[k], as[k], hold / substeps, Integrator::RK4);
+      }
+    }
+
+    // Tested: steps of dt, a whole number of them per hold period.
+    size_t steps_per_hold = static_cast<size_t>(hold / dt + 0.5);
+    std::vector<double> step_deltas, step_as;
+    for (size_t k = 0; k < n_holds; k++) {
+      step_deltas.insert(step_deltas.end(), steps_per_hold, deltas[k]);
+      step_as.insert(step_as.end(), steps_per_hold, as[k]);
+    }
+    VehicleState<double> end =
+        rollout(initial, step_deltas, step_as, dt, integrator).back();
+    total += sqrt(pow(end.x - ref.x, 2) + pow(end.y - ref.y, 2));
+  }
+  return total / samples;
+}
+
+void run_layout_suite(MPCConfig config, const std::vector<Frame>& frames) {
+  // Variable-major vs stage-major decision variables.
+  config.layout = Layout::VARIABLE_MAJOR;
+  MPC variable_major(config);
+  report("variable-major", time_solves(variable_major, frames));
+
+  config.layout = Layout::STAGE_MAJOR;
+  MPC stage_major(config);
+  report("stage-major   ", time_solves(stage_major, frames));
+}
+
+void run_integrator_suite(MPCConfig config, const std::vector<Frame>& frames) {
+  // Same look-ahead with half the steps for the higher order integrators.
+  size_t steps = config.N - 1;
+  size_t half_steps = std::max<size_t>(steps / 2, 1);
+  double half_dt = config.dt * steps / half_steps;
+  double horizon = config.dt * steps;
+
+  std::cout << "position error after " << horizon << " s (actuations held for 0.2 s):" << std::endl;
+  std::cout << "  euler dt = 0.1  " << prediction_error(Integrator::EULER, 0.1, horizon) << " m" << std::endl;
+  std::cout << "  euler dt = 0.2  " << prediction_error(Integrator::EULER, 0.2, horizon) << " m" << std::endl;
+  std::cout << "  rk4   dt = 0.2  " << prediction_error(Integrator::RK4, 0.2, horizon) << " m" << std::endl;
+  std::cout << "  ctr   dt = 0.2  " << prediction_error(Integrator::CONSTANT_TURN_RATE, 0.2, horizon) << " m" << std::endl;
+
+  config.integrator = Integrator::EULER;
+  MPC euler(config);
+  report("euler N = " + std::to_string(config.N), time_solves(euler, frames));
+
+  config.N = half_steps + 1;
+  config.dt = half_dt;
+  for (Integrator integrator : {Integrator::RK4, Integrator::CONSTANT_TURN_RATE}) {
+    config.integrator = integrator;
+    MPC mpc(config);
+    report(std::string(integrator_name(integrator)) + " N = " + std::to_string(config.N),
+           time_solves(mpc, frames));
+  }
+}
+
+void run_terminal_suite(MPCConfig config, const std::vector<Frame>& frames) {
+  size_t short_N = config.N;
+  size_t long_N = 2 * (config.N - 1) + 1;
+
+  config.N = long_N;
+  config.terminal_cost = false;
+  MPC long_horizon(config);
+  auto reference = first_actuations(long_horizon, frames);
+  report("N = " + std::to_string(long_N) + "             ", time_solves(long_horizon, frames));
+
+  config.N = short_N;
+  for (bool terminal_cost : {false, true}) {
+    config.terminal_cost = terminal_cost;
+    MPC mpc(config);
+    auto gap = actuation_gap(first_actuations(mpc, frames), reference);
+    report("N = " + std::to_string(short_N) + (terminal_cost ? " + terminal" : "           "),
+           time_solves(mpc, frames));
+    std::cout << "  first actuation gap to N = " << long_N << ": steering " << gap[0]
+              << " rad, throttle " << gap[1] << std::endl;
+  }
+}
+
+void run_rti_suite(MPCConfig config, size_t n_frames) {
+  config.solver = Solver::IPOPT;
+  MPC ipopt(config);
+  Drive reference = drive(ipopt, n_frames);
+  report("ipopt            ", reference.samples);
+  std::cout << "  mean |cte| " << reference.mean_abs_cte << " m" << std::endl;
+
+  config.solver = Solver::RTI;
+  for (double tolerance : {0.0, config.relinearise_tolerance}) {
+    config.relinearise_tolerance = tolerance;
+    MPC rti(config);
+    Drive d = drive(rti, n_frames);
+    report(tolerance > 0 ? "rti, cached      " : "rti, no reuse    ", d.samples);
+    std::cout << "  mean |cte| " << d.mean_abs_cte << " m, stages linearised per frame "
+              << d.linearised_per_frame << ", saved " << d.reused_per_frame
+              << " of " << config.N - 1 << std::endl;
+  }
+
+  config.linearisation_table = true;
+  auto start = std::chrono::steady_clock::now();
+  MPC rti(config);
+  auto end = std::chrono::steady_clock::now();
+  std::cout << "table built in " << std::chrono::duration<double, std::milli>(end - start).count()
+            << " ms" << std::endl;
+  Drive d = drive(rti, n_frames);
+  report("rti, table       ", d.samples);
+  std::cout << "  mean |cte| " << d.mean_abs_cte << " m" << std::endl;
+
+  // The same structure written to and mapped from the cache file.
+  const std::string cache = structure_cache_path(".", config);
+  std::remove(cache.c_str());
+  start = std::chrono::steady_clock::now();
+  save_structure(ProblemStructure(config), cache);
+  end = std::chrono::steady_clock::now();
+  double built = std::chrono::duration<double, std::milli>(end - start).count();
+  start = std::chrono::steady_clock::now();
+  auto loaded = load_structure(config, cache);
+  end = std::chrono::steady_clock::now();
+  std::cout << "structure cache: build and write " << built << " ms, load "
+            << std::chrono::duration<double, std::milli>(end - start).count() << " ms"
+            << (loaded ? "" : " (FAILED)") << std::endl;
+  if (loaded) {
+    MPC cached(loaded);
+    d = drive(cached, n_frames);
+    std::cout << "  mean |cte| from the cached table " << d.mean_abs_cte << " m" << std::endl;
+  }
+  std::remove(cache.c_str());
+
+  // One stage linearised by AD against a table lookup.
+  LinearisationTable table(config.dt);
+  const size_t n = 100000;
+  Eigen::Matrix4d A = Eigen::Matrix4d::Zero();
+  Eigen::Matrix<double, 4, 2> B;
+  start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < n; i++) {
+    A += linearise_step(Eigen::Vector4d(0, 0, i * 1e-5, 10), Eigen::Vector2d(0.1, 0.5),
+                        config.dt, config.integrator).A;
+  }
+  end = std::chrono::steady_clock::now();
+  double ad = std::chrono::duration<double, std::nano>(end - start).count() / n;
+  start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < n; i++) {
+    Eigen::Matrix4d Ai;
+    table.lookup(i * 1e-5, 10, 0.1, Ai, B);
+    A += Ai;
+  }
+  end = std::chrono::steady_clock::now();
+  double lookup = std::chrono::duration<double, std::nano>(end - start).count() / n;
+  std::cout << "per stage: AD " << ad << " ns, table lookup " << lookup << " ns ("
+            << table.size_bytes() / 1024 << " KiB, checksum " << A.sum() << ")" << std::endl;
+}
+
+void run_kkt_suite(MPCConfig config, size_t n_frames) {
+  // Finer and finer steps over the same look-ahead.
+  const double horizon = config.dt * (config.N - 1);
+  config.solver = Solver::RTI;
+  for (size_t N : {10, 50, 100, 200, 400}) {
+    config.N = N;
+    config.dt = horizon / (N - 1);
+    for (KKTSolver kkt_solver : {KKTSolver::SPARSE_LU, KKTSolver::MINRES}) {
+      config.kkt_solver = kkt_solver;
+      MPC mpc(config);
+      Drive d = drive(mpc, n_frames);
+      bool minres = kkt_solver == KKTSolver::MINRES;
+      std::string name = std::string(minres ? "minres" : "lu    ") + " N = " + std::to_string(N);
+      report(name + std::string(4 - std::to_string(N).size(), ' '), d.samples);
+      std::cout << "  mean |cte| " << d.mean_abs_cte << " m";
+      if (minres) {
+        std::cout << ", iterations per frame " << d.kkt_iterations_per_frame;
+      }
+      std::cout << std::endl;
+    }
+  }
+}
+
+void run_lm_suite(MPCConfig config, size_t n_frames) {
+  for (size_t N : {config.N, 2 * config.N, 4 * config.N}) {
+    config.N = N;
+    for (Solver solver : {Solver::IPOPT, Solver::LEVENBERG_MARQUARDT}) {
+      config.solver = solver;
+      MPC mpc(config);
+      Drive d = drive(mpc, n_frames);
+      bool lm = solver == Solver::LEVENBERG_MARQUARDT;
+      std::string n = std::to_string(N);
+      report(std::string(lm ? "lm    " : "ipopt ") + " N = " + n + std::string(4 - n.size(), ' '),
+             d.samples);
+      std::cout << "  mean |cte| " << d.mean_abs_cte << " m";
+      if (lm) {
+        std::cout << ", iterations per frame " << d.lm_iterations_per_frame;
+      }
+      std::cout << std::endl;
+    }
+  }
+}
+
+const char* formulation_name(Formulation formulation) {
+  switch (formulation) {
+    case Formulation::REDUCED:
+      return "reduced ";
+    case Formulation::SINGLE_SHOOTING:
+      return "shooting";
+    default:
+      return "full    ";
+  }
+}
+
+// False if Ipopt failed on any frame of any formulation.
+bool run_formulation_suite(MPCConfig config, const std::vector<Frame>& frames) {
+  // The formulations only change what Ipopt sees, so the first actuations
+  // should agree up to the solver's tolerance (and, for Euler, the
+  // definition of the errors). Single shooting has the fewest variables
+  // but a dense Hessian, so it is expected to win at short horizons only.
+  // It is also the only problem without constraints.
+  config.solver = Solver::IPOPT;
+  bool ok = true;
+  const size_t steps = config.N - 1;
+  for (size_t N : {std::max<size_t>(steps / 2, 1) + 1, config.N, 2 * steps + 1, 4 * steps + 1}) {
+    config.N = N;
+    std::string n = std::to_string(N);
+    n += std::string(4 - std::min<size_t>(n.size(), 4), ' ');
+
+    std::vector<std::vector<double>> reference;
+    for (Formulation formulation :
+         {Formulation::FULL, Formulation::REDUCED, Formulation::SINGLE_SHOOTING}) {
+      config.formulation = formulation;
+      MPC mpc(config);
+      size_t unsolved = 0;
+      auto actuations = first_actuations(mpc, frames, &unsolved);
+      report(std::string(formulation_name(formulation)) + " N = " + n, time_solves(mpc, frames));
+      // The controller's own structure, from the registry.
+      const VarIndex& idx = ProblemStructure::get(config)->nlp_idx;
+      std::cout << "  " << idx.n_vars() << " variables, " << idx.n_constraints() << " constraints, "
+                << frames.size() - unsolved << " of " << frames.size() << " frames solved";
+      ok = ok && unsolved == 0;
+      if (formulation == Formulation::FULL) {
+        reference = actuations;
+      } else {
+        auto gap = actuation_gap(actuations, reference);
+        std::cout << ", first actuation gap to full: steering " << gap[0] << " rad, throttle "
+                  << gap[1];
+      }
+      std::cout << std::endl;
+    }
+  }
+  return ok;
+}
+
+// Resident set size from /proc, 0 where that is not available.
+size_t resident_bytes() {
+  std::ifstream statm("/proc/self/statm");
+  size_t pages = 0, resident = 0;
+  statm >> pages >> resident;
+  return resident * 4096;
+}
+
+void run_controllers_suite(MPCConfig config, const std::vector<Frame>& frames) {
+  config.solver = Solver::RTI;
+  config.linearisation_table = true;
+
+  for (bool shared : {true, false}) {
+    const size_t n = shared ? 1000 : 100;
+    std::vector<std::unique_ptr<MPC>> controllers;
+    size_t before = resident_bytes();
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < n; i++) {
+      auto structure = shared ? ProblemStructure::get(config)
+                              : std::make_shared<const ProblemStructure>(config);
+      controllers.emplace_back(new MPC(structure));
+    }
+    auto end = std::chrono::steady_clock::now();
+    // One frame each, so that every workspace is in use.
+    for (size_t i = 0; i < n; i++) {
+      controllers[i]->Solve(frames[i % frames.size()].state, frames[i % frames.size()].coeffs);
+    }
+    size_t after = resident_bytes();
+    std::cout << (shared ? "shared  " : "unshared") << " " << n << " controllers: set-up "
+              << std::chrono::duration<double, std::micro>(end - start).count() / n
+              << " us, " << (after - before) / n / 1024.0 << " KiB each" << std::endl;
+  }
+  std::cout << "structure " << ProblemStructure(config).size_bytes() / 1024 << " KiB" << std::endl;
+
+  // A connection that sends one frame and goes away, with a new controller
+  // against one from the pool, which starts from the nominal frame.
+  auto structure = ProblemStructure::get(config);
+  auto built = std::chrono::steady_clock::now();
+  ControllerPool pool(structure);
+  std::cout << "pool of " << pool.capacity() << " built in "
+            << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - built).count()
+            << " ms" << std::endl;
+  const size_t n = 1000;
+  std::vector<double> fresh, pooled, fresh_frame, pooled_frame, next_frame;
+  for (size_t i = 0; i < n; i++) {
+    const Frame& f = frames[i % frames.size()];
+    auto start = std::chrono::steady_clock::now();
+    std::unique_ptr<MPC> mpc(new MPC(structure));
+    auto connected = std::chrono::steady_clock::now();
+    mpc->Solve(f.state, f.coeffs);
+    auto end = std::chrono::steady_clock::now();
+    fresh.push_back(std::chrono::duration<double, std::milli>(connected - start).count());
+    fresh_frame.push_back(std::chrono::duration<double, std::milli>(end - connected).count());
+
+    start = std::chrono::steady_clock::now();
+    Fleet* connection = pool.connect();
+    connected = std::chrono::steady_clock::now();
+    connection->begin_frame();
+    MPC& context = *connection->controller("");
+    context.Solve(f.state, f.coeffs);
+    end = std::chrono::steady_clock::now();
+    pooled.push_back(std::chrono::duration<double, std::milli>(connected - start).count());
+    pooled_frame.push_back(std::chrono::duration<double, std::milli>(end - connected).count());
+
+    // The same frame 0.1 s on, as a frame of a running connection.
+    start = std::chrono::steady_clock::now();
+    context.Solve(f.state, f.coeffs, 0.1);
+    end = std::chrono::steady_clock::now();
+    next_frame.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+    pool.disconnect(connection);
+  }
+  report("connect, new      ", fresh);
+  report("connect, pool     ", pooled);
+  report("first frame, new  ", fresh_frame);
+  report("first frame, pool ", pooled_frame);
+  report("next frame        ", next_frame);
+}
+
+// Time since the steady clock's epoch, which is shared between threads.
+int64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// A connected pair of loopback TCP sockets, as (client, server).
+bool loopback_pair(int fds[2]) {
+  int listener = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t length = sizeof(address);
+  bool ok = listener >= 0 && bind(listener, (sockaddr*)&address, sizeof(address)) == 0 &&
+            listen(listener, 1) == 0 &&
+            getsockname(listener, (sockaddr*)&address, &length) == 0;
+  fds[0] = ok ? socket(AF_INET, SOCK_STREAM, 0) : -1;
+  ok = ok && fds[0] >= 0 && connect(fds[0], (sockaddr*)&address, sizeof(address)) == 0;
+  fds[1] = ok ? accept(listener, nullptr, nullptr) : -1;
+  if (listener >= 0) {
+    close(listener);
+  }
+  int one = 1;
+  setsockopt(fds[0], IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return ok && fds[1] >= 0;
+}
+
+// A sender writes its send time at random intervals, mostly shorter than
+// the spin time with a longer pause now and then; the receiver runs the
+// given loop policy and records when each message reaches it.
+void run_wakeup_suite() {
+  const size_t n = 3000;
+  const double spin_us = BusyPollConfig().spin_us;
+  struct Mode {
+    const char* name;
+    double spin_us;
+  } modes[] = {{"default (block)  ", 0}, {"spin-then-block  ", spin_us},
+               {"spin only        ", INFINITY}};
+
+  for (const Mode& mode : modes) {
+    int fds[2];
+    if (!loopback_pair(fds)) {
+      std::cout << "no loopback socket, skipped" << std::endl;
+      return;
+    }
+    bool busy_poll = set_socket_busy_poll(fds[1], BusyPollConfig().socket_busy_poll_us);
+
+    std::thread sender([&] {
+      std::mt19937 gen(5);
+      std::uniform_int_distribution<int> pause(100, 500);
+      for (size_t i = 0; i < n; i++) {
+        int us = i % 10 == 9 ? 5000 : pause(gen);
+        std::this_thread::sleep_for(std::chrono::microseconds(us));
+        int64_t sent = now_ns();
+        if (send(fds[0], &sent, sizeof(sent), 0) != sizeof(sent)) {
+          break;
+        }
+      }
+    });
+
+    LatencyHistogram wakeups;
+    pollfd p = {fds[1], POLLIN, 0};
+    spin_then_block(mode.spin_us,
+                    [&](int timeout_ms) { return poll(&p, 1, timeout_ms) > 0; },
+                    [&] {
+                      int64_t sent;
+                      if (recv(fds[1], &sent, sizeof(sent), MSG_WAITALL) != sizeof(sent)) {
+                        return false;
+                      }
+                      wakeups.record(now_ns() - sent);
+                      return wakeups.count() < n;
+                    });
+    sender.join();
+    close(fds[0]);
+    close(fds[1]);
+    wakeups.print(std::cout, std::string(mode.name) + (busy_poll ? "" : " (no SO_BUSY_POLL)"));
+  }
+}
+
+// Nanoseconds per element of f() over n elements, best of 5 runs.
+// A double whose sin and cos are libm's, to run model.h as it would be
+// without the fastmath.h kernels: the reference of the fastmath suite.
+struct Libm {
+  double v;
+  Libm(double v = 0) : v(v) {}
+};
+Libm operator+(Libm a, Libm b) { return a.v + b.v; }
+Libm operator-(Libm a, Libm b) { return a.v - b.v; }
+Libm operator*(Libm a, Libm b) { return a.v * b.v; }
+Libm operator/(Libm a, Libm b) { return a.v / b.v; }
+Libm sin(Libm x) { return std::sin(x.v); }
+Libm cos(Libm x) { return std::cos(x.v); }
+
+template <typename F>
+double ns_per_element(F f, size_t n) {
+  double best = 1e30;
+  for (int run = 0; run < 5; run++) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    auto end = std::chrono::steady_clock::now();
+    best = std::min(best, std::chrono::duration<double, std::nano>(end - start).count() / n);
+  }
+  return best;
+}
+
+bool run_fastmath_suite(const MPCConfig& config) {
+  const double max_position_error = 1e-9;
+  bool ok = true;
+
+  std::mt19937 gen(3);
+  std::cout << Pack::width << " doubles per vector" << std::endl;
+
+  // Kernels against libm.
+  const size_t n = 1 << 16;
+  std::vector<double> angles(n), slopes(n);
+  std::uniform_real_distribution<double> angle(-100.0, 100.0);
+  std::uniform_real_distribution<double> slope(-1e3, 1e3);
+  for (size_t i = 0; i < n; i++) {
+    angles[i] = angle(gen);
+    slopes[i] = slope(gen) * std::pow(10.0, -int(i % 7));
+  }
+
+  std::vector<double> s(n), c(n), t(n), ref_s(n), ref_c(n), ref_t(n);
+  double libm_sincos = ns_per_element([&] {
+    for (size_t i = 0; i < n; i++) {
+      ref_s[i] = sin(angles[i]);
+      ref_c[i] = cos(angles[i]);
+    }
+  }, n);
+  double fast_sc = ns_per_element([&] { fast_sincos(angles.data(), s.data(), c.data(), n); }, n);
+  double libm_atan = ns_per_element([&] {
+    for (size_t i = 0; i < n; i++) {
+      ref_t[i] = atan(slopes[i]);
+    }
+  }, n);
+  double fast_at = ns_per_element([&] { fast_atan(slopes.data(), t.data(), n); }, n);
+
+  double sincos_error = 0, atan_error = 0;
+  for (size_t i = 0; i < n; i++) {
+    sincos_error = std::max(sincos_error, std::max(fabs(s[i] - ref_s[i]), fabs(c[i] - ref_c[i])));
+    atan_error = std::max(atan_error, fabs(t[i] - ref_t[i]));
+  }
+  std::cout << "sincos  libm " << libm_sincos << " ns, fast " << fast_sc
+            << " ns, max error " << sincos_error << std::endl;
+  std::cout << "atan    libm " << libm_atan << " ns, fast " << fast_at
+            << " ns, max error " << atan_error << std::endl;
+
+  // At the edge of the accurate range and past it, where the lanes go to
+  // libm instead.
+  double range_error = 0;
+  for (double x : {-1e5, 99999.99, 1e5 + 0.5, 3e6, 4503599627370496.0, -1e17, 1e300}) {
+    double fs, fc;
+    fast_sincos(x, fs, fc);
+    range_error = std::max(range_error, std::max(fabs(fs - sin(x)), fabs(fc - cos(x))));
+  }
+  std::cout << "sincos  max error at |x| >= 1e5 " << range_error << std::endl;
+  if (!(range_error <= 1e-15)) {
+    std::cout << "  FAILED: sincos error above 1e-15" << std::endl;
+    ok = false;
+  }
+
+  // Rollouts of random actuation sequences over the horizon: one vehicle at
+  // a time with libm (the reference) and with the kernels, and all of them
+  // with step_batch().
+  const size_t vehicles = 1024;
+  const size_t steps = config.N - 1;
+  std::uniform_real_distribution<double> steer(-0.436332, 0.436332);
+  std::uniform_real_distribution<double> accel(-1.0, 1.0);
+  std::uniform_real_distribution<double> speed(5.0, 25.0);
+  std::uniform_real_distribution<double> heading(-M_PI, M_PI);
+
+  VehicleBatch initial(vehicles);
+  for (size_t i = 0; i < vehicles; i++) {
+    initial.set(i, {0, 0, heading(gen), speed(gen)});
+  }
+  // Actuations of step k for vehicle i at k * vehicles + i.
+  std::vector<double> deltas(steps * vehicles), as(steps * vehicles);
+  for (size_t k = 0; k < deltas.size(); k++) {
+    deltas[k] = steer(gen);
+    as[k] = accel(gen);
+  }
+
+  Eigen::VectorXd coeffs(4);
+  coeffs << 1, 0.1, -2e-3, 1e-5;
+
+  for (Integrator integrator : {Integrator::EULER, Integrator::RK4,
+                                Integrator::CONSTANT_TURN_RATE}) {
+    VehicleBatch reference(vehicles), scalar, batch;
+    double libm_ns = ns_per_element([&] {
+      for (size_t i = 0; i < vehicles; i++) {
+        VehicleState<double> s0 = initial.get(i);
+        VehicleState<Libm> state = {s0.x, s0.y, s0.psi, s0.v};
+        for (size_t k = 0; k < steps; k++) {
+          state = step(state, Libm(deltas[k * vehicles + i]), Libm(as[k * vehicles + i]),
+                       config.dt, integrator);
+        }
+        reference.set(i, {state.x.v, state.y.v, state.psi.v, state.v.v});
+      }
+    }, vehicles * steps);
+    double scalar_ns = ns_per_element([&] {
+      scalar = initial;
+      for (size_t i = 0; i < vehicles; i++) {
+        VehicleState<double> state = scalar.get(i);
+        for (size_t k = 0; k < steps; k++) {
+          state = step(state, deltas[k * vehicles + i], as[k * vehicles + i],
+                       config.dt, integrator);
+        }
+        scalar.set(i, state);
+      }
+    }, vehicles * steps);
+    double batch_ns = ns_per_element([&] {
+      batch = initial;
+      for (size_t k = 0; k < steps; k++) {
+        step_batch(batch, &deltas[k * vehicles], &as[k * vehicles], config.dt, integrator);
+      }
+    }, vehicles * steps);
+
+    double position_error = 0, batch_gap = 0;
+    for (size_t i = 0; i < vehicles; i++) {
+      for (const VehicleBatch* b : {&scalar, &batch}) {
+        position_error = std::max(position_error, std::max(fabs(b->x[i] - reference.x[i]),
+                                                           fabs(b->y[i] - reference.y[i])));
+      }
+      batch_gap = std::max(batch_gap, std::max(fabs(batch.x[i] - scalar.x[i]),
+                                               fabs(batch.y[i] - scalar.y[i])));
+    }
+
+    // Track errors at the end of the rollout against the scalar formulas.
+    std::vector<double> cte(vehicles), epsi(vehicles);
+    track_errors_batch(batch, coeffs, cte.data(), epsi.data());
+    double error_gap = 0;
+    for (size_t i = 0; i < vehicles; i++) {
+      double x = batch.x[i];
+      double f = polyeval(coeffs, x);
+      double df = coeffs[1] + 2 * coeffs[2] * x + 3 * coeffs[3] * x * x;
+      error_gap = std::max(error_gap, std::max(fabs(cte[i] - (f - batch.y[i])),
+                                               fabs(epsi[i] - (batch.psi[i] - atan(df)))));
+    }
+
+    std::cout << integrator_name(integrator) << "  libm " << libm_ns << " ns, scalar "
+              << scalar_ns << " ns, batch " << batch_ns
+              << " ns per vehicle step, max position error against libm " << position_error
+              << " m after " << steps << " steps, batch against scalar " << batch_gap
+              << " m, cte/epsi " << error_gap << std::endl;
+    if (!(position_error <= max_position_error)) {
+      std::cout << "  FAILED: position error above " << max_position_error << " m" << std::endl;
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+// --compare: every sample set in both files, base against candidate.
+// Returns false if any of them regressed.
+bool compare_results(const std::string& base_path, const std::string& candidate_path) {
+  Results base, candidate;
+  if (!read_results(base_path, base) || !read_results(candidate_path, candidate)) {
+    std::cerr << "Could not read " << base_path << " and " << candidate_path << std::endl;
+    return false;
+  }
+  std::cout << "change from " << base_path << " to " << candidate_path << ", "
+            << 100 * confidence << "% confidence intervals:" << std::endl;
+  bool ok = true;
+  auto percent = [](double x) { return std::round(1000 * x) / 10; };
+  auto print = [&](const char* what, const Change& c) {
+    std::cout << "  " << what << " " << c.base << " -> " << c.candidate << " ms, "
+              << std::showpos << percent(c.relative) << "% [" << percent(c.interval.low) << "%, "
+              << percent(c.interval.high) << "%]" << std::noshowpos << "  "
+              << verdict_name(c.verdict) << std::endl;
+    ok = ok && c.verdict != Verdict::REGRESSION;
+  };
+  for (const auto& b : base) {
+    auto c = candidate.find(b.first);
+    if (c == candidate.end() || b.second.empty() || c->second.empty()) {
+      continue;
+    }
+    std::cout << b.first << std::endl;
+    print("mean", compare_mean(b.second, c->second, confidence));
+    print("p99 ", compare_p99(b.second, c->second, confidence));
+  }
+  return ok;
+}
+
+int main(int argc, char* argv[]) {
+  size_t n_frames = 200;
+  size_t repeats = 1;
+  std::string suite;
+  std::string output;
+  std::vector<std::string> compare;
+  MPCConfig config;
+  config.verbose = false;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--suite") && i + 1 < argc) {
+      suite = argv[++i];
+    } else if (!strcmp(argv[i], "--frames") && i + 1 < argc) {
+      n_frames = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--repeats") && i + 1 < argc) {
+      repeats = std::max(atoi(argv[++i]), 1);
+    } else if (!strcmp(argv[i], "--confidence") && i + 1 < argc) {
+      confidence = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--output") && i + 1 < argc) {
+      output = argv[++i];
+    } else if (!strcmp(argv[i], "--compare") && i + 2 < argc) {
+      compare = {argv[i + 1], argv[i + 2]};
+      i += 2;
+    } else if (!strcmp(argv[i], "--N") && i + 1 < argc) {
+      config.N = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--dt") && i + 1 < argc) {
+      config.dt = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--integrator") && i + 1 < argc) {
+      std::string name = argv[++i];
+      config.integrator = name == "rk4" ? Integrator::RK4
+                        : name == "ctr" ? Integrator::CONSTANT_TURN_RATE
+                        : Integrator::EULER;
+    } else if (!strcmp(argv[i], "--terminal-cost")) {
+      config.terminal_cost = true;
+    } else if (!strcmp(argv[i], "--variable-major")) {
+      config.layout = Layout::VARIABLE_MAJOR;
+    } else if (!strcmp(argv[i], "--reduced")) {
+      config.formulation = Formulation::REDUCED;
+    } else if (!strcmp(argv[i], "--single-shooting")) {
+      config.formulation = Formulation::SINGLE_SHOOTING;
+    } else if (!strcmp(argv[i], "--ipopt-timing")) {
+      config.ipopt_options += "Integer print_level  3\n";
+      config.ipopt_options += "String  print_timing_statistics yes\n";
+    } else {
+      std::cerr << "Usage: " << argv[0]
+                << " [--suite name] [--frames K] [--repeats R] [--confidence c]"
+                << " [--output file] [--compare base candidate] [--N n] [--dt s]"
+                << " [--integrator euler|rk4|ctr] [--terminal-cost]"
+                << " [--variable-major] [--reduced] [--single-shooting]"
+                << " [--ipopt-timing]" << std::endl;
+      return -1;
+    }
+  }
+
+  if (!compare.empty()) {
+    return compare_results(compare[0], compare[1]) ? 0 : 1;
+  }
+
+  auto frames = make_frames(n_frames, 42);
+  std::cout << n_frames << " frames, N = " << config.N
+            << ", dt = " << config.dt << std::endl;
+
+  std::vector<std::string> suites = {"layout", "integrator", "terminal", "rti", "kkt", "lm",
+                                     "formulation", "controllers", "wakeup", "fastmath"};
+  if (!suite.empty()) {
+    suites = {suite};
+  }
+  bool ok = true;
+  std::mt19937 gen(1);
+  for (size_t repeat = 0; repeat < repeats; repeat++) {
+    if (repeats > 1) {
+      // A different order every time, so that drift over the run (heat,
+      // other load) does not always favour the same configuration.
+      std::shuffle(suites.begin(), suites.end(), gen);
+      std::shuffle(frames.begin(), frames.end(), gen);
+      std::cout << "=== run " << repeat + 1 << " of " << repeats << std::endl;
+    }
+    for (const std::string& name : suites) {
+      current_suite = name;
+      std::cout << "== " << name << std::endl;
+      if (name == "layout") {
+        run_layout_suite(config, frames);
+      } else if (name == "integrator") {
+        run_integrator_suite(config, frames);
+      } else if (name == "terminal") {
+        run_terminal_suite(config, frames);
+      } else if (name == "rti") {
+        run_rti_suite(config, n_frames);
+      } else if (name == "kkt") {
+        run_kkt_suite(config, n_frames);
+      } else if (name == "lm") {
+        run_lm_suite(config, n_frames);
+      } else if (name == "formulation") {
+        ok = run_formulation_suite(config, frames) && ok;
+      } else if (name == "controllers") {
+        run_controllers_suite(config, frames);
+      } else if (name == "wakeup") {
+        run_wakeup_suite();
+      } else if (name == "fastmath") {
+        ok = run_fastmath_suite(config) && ok;
+      }
+    }
+  }
+
+  if (repeats > 1) {
+    std::cout << "=== all " << repeats << " runs" << std::endl;
+    for (const auto& r : results) {
+      print_summary(r.first, summarise(r.second, confidence));
+    }
+  }
+  if (!output.empty() && !write_results(output, results)) {
+    std::cerr << "Could not write " << output << std::endl;
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,111 @@
+#ifndef BUSY_POLL_H
+#define BUSY_POLL_H
+
+#include <sys/socket.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/*
+ Low-latency event loop mode for a dedicated core.
+
+ By default the loop sleeps in epoll_wait until a message arrives, and
+ the scheduler's wake-up adds tens of microseconds, with a long tail, to
+ every frame. In busy-poll mode the loop keeps checking for work without
+ sleeping. It only blocks after spin_us without any event, so a core that
+ goes idle is eventually given back.
+ */
+struct BusyPollConfig {
+  bool enabled = false;
+
+  // Keep polling this long after the last event before blocking.
+  // INFINITY never blocks; 0 blocks right away, like the default loop.
+  double spin_us = 1000;
+
+  // SO_BUSY_POLL on every connection: a read that would block polls the
+  // device queue for this long first. Raising it above
+  // net.core.busy_read needs CAP_NET_ADMIN; 0 leaves it alone.
+  int socket_busy_poll_us = 50;
+};
+
+// Set SO_BUSY_POLL on fd. False where the kernel does not have it or does
+// not allow it.
+inline bool set_socket_busy_poll(int fd, int us) {
+#ifdef SO_BUSY_POLL
+  return setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &us, sizeof(us)) == 0;
+#else
+  (void)fd;
+  (void)us;
+  return false;
+#endif
+}
+
+// Spin-then-block. wait(0) checks for work without blocking, wait(-1)
+// blocks until there may be some; both return whether there is.
+// handle() does the work and returns false to stop.
+template <typename Wait, typename Handle>
+void spin_then_block(double spin_us, Wait wait, Handle handle) {
+  typedef std::chrono::steady_clock Clock;
+  Clock::time_point last_event = Clock::now();
+  for (;;) {
+    bool ready = wait(0);
+    if (!ready) {
+      double idle = std::chrono::duration<double, std::micro>(Clock::now() - last_event).count();
+      if (idle < spin_us) {
+        continue;
+      }
+      ready = wait(-1);
+    }
+    if (ready) {
+      if (!handle()) {
+        return;
+      }
+      last_event = Clock::now();
+    }
+  }
+}
+
+// Latency samples in power-of-two buckets of nanoseconds, plus exact
+// percentiles.
+class LatencyHistogram {
+ public:
+  void record(double ns) { samples.push_back(ns); }
+
+  size_t count() const { return samples.size(); }
+
+  double percentile(double p) const {
+    std::vector<double> sorted = samples;
+    std::sort(sorted.begin(), sorted.end());
+    return sorted[std::min(sorted.size() - 1, static_cast<size_t>(p / 100 * sorted.size()))];
+  }
+
+  void print(std::ostream& out, const std::string& name) const {
+    if (samples.empty()) {
+      out << name << "  no samples" << std::endl;
+      return;
+    }
+    out << name << "  p50 " << percentile(50) / 1e3 << " us  p90 " << percentile(90) / 1e3
+        << " us  p99 " << percentile(99) / 1e3 << " us  p99.9 " << percentile(99.9) / 1e3
+        << " us  max " << percentile(100) / 1e3 << " us" << std::endl;
+    std::vector<size_t> buckets(64, 0);
+    for (double ns : samples) {
+      buckets[std::min<size_t>(63, ns < 1 ? 0 : static_cast<size_t>(std::log2(ns)))]++;
+    }
+    for (size_t b = 0; b < buckets.size(); b++) {
+      if (buckets[b] > 0) {
+        out << "    < " << (uint64_t(2) << b) / 1e3 << " us  "
+            << std::string(1 + 50 * buckets[b] / samples.size(), '#') << " " << buckets[b]
+            << std::endl;
+      }
+    }
+  }
+
+ private:
+  std::vector<double> samples;
+};
+
+#endif /* BUSY_POLL_H */
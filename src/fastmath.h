@@ -0,0 +1,267 @@
+#ifndef FASTMATH_H
+#define FASTMATH_H
+
+#include <cmath>
+#include <cstddef>
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/*
+ Vectorised sin, cos and atan for the model code (model.h), which takes
+ its double precision sines and cosines from here, one value or one Pack
+ at a time.
+
+ Each kernel is written once against Pack, a few doubles handled together:
+ 4 with AVX, 2 with SSE2 and 1 otherwise, picked from the compiler flags
+ (e.g. -mavx). Results do not depend on the width.
+
+ Accuracy against libm, in absolute error:
+   fast_sincos  below 5e-16 for |x| <= 1e5. The argument reduction uses a
+                two-part pi/2 which loses accuracy beyond that, and the
+                rounding fails altogether past 2^51, so lanes above 1e5
+                (or not finite) are handed to libm instead.
+   fast_atan    below 4e-16 for all x (Cephes rational approximation)
+
+ Nothing here relies on -ffast-math; the rounding trick below needs the
+ compiler to keep (x + C) - C as written.
+ */
+
+#if defined(__AVX__)
+
+struct Pack {
+  static const size_t width = 4;
+  __m256d v;
+  Pack() {}
+  Pack(__m256d v) : v(v) {}
+  Pack(double x) : v(_mm256_set1_pd(x)) {}
+  static Pack load(const double* p) { return _mm256_loadu_pd(p); }
+  void store(double* p) const { _mm256_storeu_pd(p, v); }
+};
+typedef Pack Mask;
+inline Pack operator+(Pack a, Pack b) { return _mm256_add_pd(a.v, b.v); }
+inline Pack operator-(Pack a, Pack b) { return _mm256_sub_pd(a.v, b.v); }
+inline Pack operator*(Pack a, Pack b) { return _mm256_mul_pd(a.v, b.v); }
+inline Pack operator/(Pack a, Pack b) { return _mm256_div_pd(a.v, b.v); }
+inline Mask operator<(Pack a, Pack b) { return _mm256_cmp_pd(a.v, b.v, _CMP_LT_OQ); }
+inline Mask operator>(Pack a, Pack b) { return _mm256_cmp_pd(a.v, b.v, _CMP_GT_OQ); }
+inline Mask operator==(Pack a, Pack b) { return _mm256_cmp_pd(a.v, b.v, _CMP_EQ_OQ); }
+inline Mask operator|(Mask a, Mask b) { return _mm256_or_pd(a.v, b.v); }
+// Not blendv: GCC turns that into a conditional it then expands lane by
+// lane with branches for AVX without AVX2.
+inline Pack select(Mask m, Pack a, Pack b) {
+  return _mm256_or_pd(_mm256_and_pd(m.v, a.v), _mm256_andnot_pd(m.v, b.v));
+}
+inline bool all(Mask m) { return _mm256_movemask_pd(m.v) == 0xf; }
+inline Pack abs(Pack a) { return _mm256_andnot_pd(_mm256_set1_pd(-0.0), a.v); }
+
+#elif defined(__SSE2__)
+
+struct Pack {
+  static const size_t width = 2;
+  __m128d v;
+  Pack() {}
+  Pack(__m128d v) : v(v) {}
+  Pack(double x) : v(_mm_set1_pd(x)) {}
+  static Pack load(const double* p) { return _mm_loadu_pd(p); }
+  void store(double* p) const { _mm_storeu_pd(p, v); }
+};
+typedef Pack Mask;
+inline Pack operator+(Pack a, Pack b) { return _mm_add_pd(a.v, b.v); }
+inline Pack operator-(Pack a, Pack b) { return _mm_sub_pd(a.v, b.v); }
+inline Pack operator*(Pack a, Pack b) { return _mm_mul_pd(a.v, b.v); }
+inline Pack operator/(Pack a, Pack b) { return _mm_div_pd(a.v, b.v); }
+inline Mask operator<(Pack a, Pack b) { return _mm_cmplt_pd(a.v, b.v); }
+inline Mask operator>(Pack a, Pack b) { return _mm_cmpgt_pd(a.v, b.v); }
+inline Mask operator==(Pack a, Pack b) { return _mm_cmpeq_pd(a.v, b.v); }
+inline Mask operator|(Mask a, Mask b) { return _mm_or_pd(a.v, b.v); }
+// No blendv before SSE4.1.
+inline Pack select(Mask m, Pack a, Pack b) {
+  return _mm_or_pd(_mm_and_pd(m.v, a.v), _mm_andnot_pd(m.v, b.v));
+}
+inline bool all(Mask m) { return _mm_movemask_pd(m.v) == 0x3; }
+inline Pack abs(Pack a) { return _mm_andnot_pd(_mm_set1_pd(-0.0), a.v); }
+
+#else
+
+struct Pack {
+  static const size_t width = 1;
+  double v;
+  Pack() {}
+  Pack(double v) : v(v) {}
+  static Pack load(const double* p) { return *p; }
+  void store(double* p) const { *p = v; }
+};
+struct Mask {
+  bool v;
+  Mask(bool v) : v(v) {}
+};
+inline Pack operator+(Pack a, Pack b) { return a.v + b.v; }
+inline Pack operator-(Pack a, Pack b) { return a.v - b.v; }
+inline Pack operator*(Pack a, Pack b) { return a.v * b.v; }
+inline Pack operator/(Pack a, Pack b) { return a.v / b.v; }
+inline Mask operator<(Pack a, Pack b) { return Mask(a.v < b.v); }
+inline Mask operator>(Pack a, Pack b) { return Mask(a.v > b.v); }
+inline Mask operator==(Pack a, Pack b) { return Mask(a.v == b.v); }
+inline Mask operator|(Mask a, Mask b) { return Mask(a.v || b.v); }
+inline Pack select(Mask m, Pack a, Pack b) { return m.v ? a : b; }
+inline bool all(Mask m) { return m.v; }
+inline Pack abs(Pack a) { return std::fabs(a.v); }
+// Excess precision (e.g. x87) would break the trick below.
+inline Pack round_nearest(Pack x) { return std::nearbyint(x.v); }
+
+#endif
+
+#if defined(__AVX__) || defined(__SSE2__)
+// Round to the nearest integer for |x| < 2^51: adding 1.5 * 2^52 leaves no
+// bits for the fraction.
+inline Pack round_nearest(Pack x) {
+  const Pack magic(6755399441055744.0);
+  return (x + magic) - magic;
+}
+#endif
+
+// Largest |x| the argument reduction below is accurate for.
+const double max_reduced_angle = 1e5;
+
+inline void sincos_pack(Pack x, Pack& s, Pack& c) {
+  // x = k * pi/2 + r with |r| <= pi/4. pi/2 is split in two so that k * hi
+  // is exact.
+  const Pack two_over_pi(0.63661977236758134308);
+  const Pack pio2_hi(1.5707963267341256);
+  const Pack pio2_lo(6.077100506506192e-11);
+  Pack k = round_nearest(x * two_over_pi);
+  Pack r = (x - k * pio2_hi) - k * pio2_lo;
+  Pack r2 = r * r;
+
+  // Taylor series on |r| <= pi/4, truncation error below 1e-16.
+  Pack ps = Pack(-1.0 / 1307674368000) * r2 + Pack(1.0 / 6227020800);
+  ps = ps * r2 - Pack(1.0 / 39916800);
+  ps = ps * r2 + Pack(1.0 / 362880);
+  ps = ps * r2 - Pack(1.0 / 5040);
+  ps = ps * r2 + Pack(1.0 / 120);
+  ps = ps * r2 - Pack(1.0 / 6);
+  Pack sin_r = r + r * r2 * ps;
+
+  Pack pc = Pack(-1.0 / 20922789888000) * r2 + Pack(1.0 / 87178291200);
+  pc = pc * r2 - Pack(1.0 / 479001600);
+  pc = pc * r2 + Pack(1.0 / 3628800);
+  pc = pc * r2 - Pack(1.0 / 40320);
+  pc = pc * r2 + Pack(1.0 / 720);
+  pc = pc * r2 - Pack(1.0 / 24);
+  pc = pc * r2 + Pack(0.5);
+  Pack cos_r = Pack(1.0) - r2 * pc;
+
+  // Quadrant q = k mod 4. (k - 1.5) / 4 is never halfway between two
+  // integers, so rounding it floors k / 4.
+  Pack q = k - Pack(4.0) * round_nearest((k - Pack(1.5)) * Pack(0.25));
+  Mask q1 = q == Pack(1.0);
+  Mask q2 = q == Pack(2.0);
+  Mask q3 = q == Pack(3.0);
+
+  // sin: sin r, cos r, -sin r, -cos r for q = 0..3
+  // cos: cos r, -sin r, -cos r, sin r
+  Mask swap = q1 | q3;
+  Pack s_abs = select(swap, cos_r, sin_r);
+  Pack c_abs = select(swap, sin_r, cos_r);
+  s = select(q2 | q3, Pack(0.0) - s_abs, s_abs);
+  c = select(q1 | q2, Pack(0.0) - c_abs, c_abs);
+
+  // Out of range, which the model never gets near: libm, lane by lane.
+  const Pack limit(max_reduced_angle);
+  Pack ax = abs(x);
+  if (!all((ax < limit) | (ax == limit))) {
+    double lx[Pack::width], ls[Pack::width], lc[Pack::width];
+    x.store(lx);
+    s.store(ls);
+    c.store(lc);
+    for (size_t i = 0; i < Pack::width; i++) {
+      if (!(std::fabs(lx[i]) <= max_reduced_angle)) {
+        ls[i] = std::sin(lx[i]);
+        lc[i] = std::cos(lx[i]);
+      }
+    }
+    s = Pack::load(ls);
+    c = Pack::load(lc);
+  }
+}
+
+inline Pack atan_pack(Pack x) {
+  // Cephes atan: reduce |x| to [0, 0.66] with
+  // atan(x) = pi/2 - atan(1/x) and atan(x) = pi/4 + atan((x-1)/(x+1)).
+  const Pack zero(0.0);
+  Mask negative = x < zero;
+  Pack ax = abs(x);
+
+  Mask big = ax > Pack(2.41421356237309504880);
+  Mask mid = ax > Pack(0.66);
+  Pack y0 = select(big, Pack(1.57079632679489661923),
+                   select(mid, Pack(0.78539816339744830962), zero));
+  Pack more = select(big, Pack(6.123233995736765886130e-17),
+                     select(mid, Pack(3.061616997868382943065e-17), zero));
+  Pack t = select(big, Pack(-1.0) / ax,
+                  select(mid, (ax - Pack(1.0)) / (ax + Pack(1.0)), ax));
+
+  Pack z = t * t;
+  Pack p = Pack(-8.750608600031904122785e-1) * z - Pack(1.615753718733365076637e1);
+  p = p * z - Pack(7.500855792314704667340e1);
+  p = p * z - Pack(1.228866684490136173410e2);
+  p = p * z - Pack(6.485021904942025371773e1);
+  Pack q = z + Pack(2.485846490142306297962e1);
+  q = q * z + Pack(1.650270098316988542046e2);
+  q = q * z + Pack(4.328810604912902668951e2);
+  q = q * z + Pack(4.853903996359136964868e2);
+  q = q * z + Pack(1.945506571482613964425e2);
+
+  Pack y = y0 + (t * z * p / q + t + more);
+  return select(negative, zero - y, y);
+}
+
+// s[i] = sin(x[i]), c[i] = cos(x[i]) for i < n.
+inline void fast_sincos(const double* x, double* s, double* c, size_t n) {
+  size_t i = 0;
+  for (; i + Pack::width <= n; i += Pack::width) {
+    Pack ps, pc;
+    sincos_pack(Pack::load(x + i), ps, pc);
+    ps.store(s + i);
+    pc.store(c + i);
+  }
+  // The remainder goes through the same kernel one lane at a time.
+  for (; i < n; i++) {
+    double lanes[Pack::width] = {x[i]};
+    double ls[Pack::width], lc[Pack::width];
+    Pack ps, pc;
+    sincos_pack(Pack::load(lanes), ps, pc);
+    ps.store(ls);
+    pc.store(lc);
+    s[i] = ls[0];
+    c[i] = lc[0];
+  }
+}
+
+// sin(x) and cos(x) of a single value with the same kernel.
+inline void fast_sincos(double x, double& s, double& c) {
+  Pack ps, pc;
+  sincos_pack(Pack(x), ps, pc);
+  double ls[Pack::width], lc[Pack::width];
+  ps.store(ls);
+  pc.store(lc);
+  s = ls[0];
+  c = lc[0];
+}
+
+// y[i] = atan(x[i]) for i < n.
+inline void fast_atan(const double* x, double* y, size_t n) {
+  size_t i = 0;
+  for (; i + Pack::width <= n; i += Pack::width) {
+    atan_pack(Pack::load(x + i)).store(y + i);
+  }
+  for (; i < n; i++) {
+    double lanes[Pack::width] = {x[i]};
+    double ly[Pack::width];
+    atan_pack(Pack::load(lanes)).store(ly);
+    y[i] = ly[0];
+  }
+}
+
+#endif /* FASTMATH_H */
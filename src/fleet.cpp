@@ -0,0 +1,129 @@
+#include "fleet.h"
+#include <algorithm>
+
+Fleet::~Fleet() { detach(); }
+
+bool Fleet::attach() {
+  car = Vehicle{pool.acquire(), frame};
+  return car.mpc != nullptr;
+}
+
+void Fleet::detach() {
+  pool.release(car.mpc);
+  car.mpc = nullptr;
+  for (auto& v : controllers) {
+    pool.release(v.second.mpc);
+  }
+  controllers.clear();
+}
+
+MPC* Fleet::controller(const std::string& id) {
+  if (id.empty()) {
+    if (!car.mpc || car.frame == frame) {
+      return nullptr;
+    }
+    car.frame = frame;
+    return car.mpc;
+  }
+  auto v = controllers.find(id);
+  if (v == controllers.end()) {
+    MPC* mpc = pool.acquire();
+    if (mpc) {
+      controllers[id] = Vehicle{mpc, frame};
+    }
+    return mpc;
+  }
+  if (v->second.frame == frame) {
+    return nullptr;
+  }
+  v->second.frame = frame;
+  return v->second.mpc;
+}
+
+void Fleet::release_absent() {
+  for (auto v = controllers.begin(); v != controllers.end();) {
+    if (v->second.frame != frame) {
+      pool.release(v->second.mpc);
+      v = controllers.erase(v);
+    } else {
+      ++v;
+    }
+  }
+}
+
+WorkerThreads::WorkerThreads(size_t n) : next(0) {
+  if (n == 0) {
+    n = std::max(std::thread::hardware_concurrency(), 1u);
+  }
+  for (size_t i = 1; i < n; i++) {
+    threads.emplace_back(&WorkerThreads::work, this);
+  }
+}
+
+WorkerThreads::~WorkerThreads() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (std::thread& t : threads) {
+    t.join();
+  }
+}
+
+void WorkerThreads::run(size_t n, const std::function<void(size_t)>& fn) {
+  if (threads.empty() || n < 2) {
+    for (size_t i = 0; i < n; i++) {
+      fn(i);
+    }
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    task = &fn;
+    n_tasks = n;
+    next = 0;
+    batch++;
+  }
+  wake.notify_all();
+  drain(fn, n);
+
+  // Every task is taken; wait for the ones still running. A worker that
+  // wakes up for this batch after that finds no task.
+  std::unique_lock<std::mutex> lock(mutex);
+  idle.wait(lock, [&] { return active == 0; });
+  task = nullptr;
+  n_tasks = 0;
+}
+
+void WorkerThreads::drain(const std::function<void(size_t)>& fn, size_t n) {
+  for (size_t i; (i = next++) < n;) {
+    fn(i);
+  }
+}
+
+void WorkerThreads::work() {
+  uint64_t seen = 0;
+  for (;;) {
+    const std::function<void(size_t)>* fn;
+    size_t n;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wake.wait(lock, [&] { return stopping || batch != seen; });
+      if (stopping) {
+        return;
+      }
+      seen = batch;
+      fn = task;
+      n = n_tasks;
+      active++;
+    }
+    if (fn) {
+      drain(*fn, n);
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    if (--active == 0) {
+      idle.notify_all();
+    }
+  }
+}
@@ -0,0 +1,112 @@
+#ifndef FLEET_H
+#define FLEET_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "MPC.h"
+#include "pool.h"
+
+/*
+ Many vehicles on one connection.
+
+ A fleet simulator sends one frame per tick with the telemetry of every
+ vehicle, each record keyed by an id, and gets back one frame with the
+ actuations of every vehicle in the same order (see telemetry.h). The
+ framing, the system calls, the parse and the latency hold-back are paid
+ once per tick instead of once per vehicle, and the vehicles are solved in
+ parallel.
+
+ Each id keeps its own controller for as long as it is in the frames: a
+ vehicle that is left out of a frame gives its controller back to the pool,
+ and starts over if it comes back. A vehicle that finds the pool empty
+ gets no controller and is answered with an error.
+ */
+
+// The controllers of the vehicles of one connection, kept by the pool (see
+// ControllerPool::connect). Used by one thread at a time: the event loop's,
+// or in mpc_uring the solver thread's while a message is being handled.
+class Fleet {
+ public:
+  explicit Fleet(ControllerPool& pool) : pool(pool) {}
+  ~Fleet();
+
+  // Take the controller of the connection's car, id "" below. False if
+  // the pool has none left.
+  bool attach();
+
+  // Give every controller back and forget the ids.
+  void detach();
+
+  // Start a frame.
+  void begin_frame() { frame++; }
+
+  // The controller of vehicle id, from the pool the first time the id comes
+  // up; "" is the car's, from attach(). Null if the id already came up in
+  // this frame, so that no two solves of a frame share a controller, or if
+  // the pool has none left.
+  MPC* controller(const std::string& id);
+
+  // Whether id has a controller, i.e. came up in this or the last frame.
+  bool contains(const std::string& id) const { return controllers.count(id) > 0; }
+
+  // Give back the controllers of the vehicles that did not come up in this
+  // frame.
+  void release_absent();
+
+  size_t size() const { return controllers.size(); }
+
+ private:
+  struct Vehicle {
+    MPC* mpc;
+    // The last frame the vehicle came up in.
+    uint64_t frame;
+  };
+
+  ControllerPool& pool;
+  Vehicle car = Vehicle{nullptr, 0};
+  std::map<std::string, Vehicle> controllers;
+  uint64_t frame = 0;
+};
+
+// A fixed set of threads that runs the tasks of a batch together with the
+// calling thread, shared by every connection of a server.
+class WorkerThreads {
+ public:
+  // threads in all, counting the caller of run(); 0 for one per core.
+  explicit WorkerThreads(size_t threads = 0);
+  ~WorkerThreads();
+
+  // task(i) for every i in [0, n), in any order and on any of the threads.
+  // Returns once all of them are done. task must not throw.
+  void run(size_t n, const std::function<void(size_t)>& task);
+
+  size_t size() const { return threads.size() + 1; }
+
+ private:
+  void work();
+  // Run tasks of the current batch until none are left.
+  void drain(const std::function<void(size_t)>& task, size_t n);
+
+  std::vector<std::thread> threads;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable idle;
+
+  // The current batch, guarded by mutex, and the index of its next task.
+  const std::function<void(size_t)>* task = nullptr;
+  size_t n_tasks = 0;
+  uint64_t batch = 0;
+  std::atomic<size_t> next;
+  // Workers between picking up a batch and finishing their tasks of it.
+  size_t active = 0;
+  bool stopping = false;
+};
+
+#endif /* FLEET_H */
@@ -0,0 +1,60 @@
+#ifndef HELPERS_H
+#define HELPERS_H
+
+#include <math.h>
+#include <cassert>
+#include <vector>
+#include "Eigen-3.3/Eigen/Core"
+#include "Eigen-3.3/Eigen/QR"
+
+using namespace std;
+
+// Waypoint processing shared by the server and the benchmark.
+
+// Evaluate a polynomial.
+inline double polyeval(Eigen::VectorXd coeffs, double x) {
+  double result = 0.0;
+  for (int i = 0; i < coeffs.size(); i++) {
+    result += coeffs[i] * pow(x, i);
+  }
+  return result;
+}
+
+// Fit a polynomial.
+// Adapted from
+// https://github.com/JuliaMath/Polynomials.jl/blob/master/src/Polynomials.jl#L676-L716
+inline Eigen::VectorXd polyfit(Eigen::VectorXd xvals, Eigen::VectorXd yvals,
+                               int order) {
+  assert(xvals.size() == yvals.size());
+  assert(order >= 1 && order <= xvals.size() - 1);
+  Eigen::MatrixXd A(xvals.size(), order + 1);
+
+  for (int i = 0; i < xvals.size(); i++) {
+    A(i, 0) = 1.0;
+  }
+
+  for (int j = 0; j < xvals.size(); j++) {
+    for (int i = 0; i < order; i++) {
+      A(j, i + 1) = A(j, i) * xvals(j);
+    }
+  }
+
+  auto Q = A.householderQr();
+  auto result = Q.solve(yvals);
+  return result;
+}
+
+inline vector<double> global2car(double psi, double px, double py, double x_global, double y_global)
+{
+    double dx = x_global - px;
+    double dy = y_global - py;
+    double sin_psi = sin(psi);
+    double cos_psi = cos(psi);
+
+    double x_car = dx*cos_psi + dy*sin_psi;
+    double y_car = - dx*sin_psi + dy*cos_psi;
+
+    return {x_car, y_car};
+}
+
+#endif /* HELPERS_H */
@@ -0,0 +1,235 @@
+#include "kkt.h"
+
+StageConstraints::StageConstraints(size_t N, Layout layout)
+    : J(N - 1, Eigen::Matrix<double, 6, 8>::Zero()),
+      b(Eigen::VectorXd::Zero(N * n_states)),
+      N(N),
+      idx(N, layout) {}
+
+Eigen::VectorXd StageConstraints::rhs() const {
+  Eigen::VectorXd r(rows());
+  r.head(idx.n_constraints()) = b;
+  for (size_t i = 0; i < fixed.size(); i++) {
+    r[idx.n_constraints() + i] = fixed[i].second;
+  }
+  return r;
+}
+
+void StageConstraints::multiply(const Eigen::VectorXd& w, Eigen::VectorXd& r) const {
+  r.resize(rows());
+  for (size_t k = 0; k < n_states; k++) {
+    r[idx.row(k, 0)] = w[idx.at(k, 0)];
+  }
+  for (size_t t = 0; t + 1 < N; t++) {
+    Eigen::Matrix<double, 8, 1> z;
+    for (size_t j = 0; j < 8; j++) {
+      z[j] = w[idx.at(j, t)];
+    }
+    Eigen::Matrix<double, 6, 1> Jz = J[t] * z;
+    for (size_t k = 0; k < n_states; k++) {
+      r[idx.row(k, t + 1)] = w[idx.at(k, t + 1)] - Jz[k];
+    }
+  }
+  for (size_t i = 0; i < fixed.size(); i++) {
+    r[idx.n_constraints() + i] = w[fixed[i].first];
+  }
+}
+
+void StageConstraints::multiply_transpose_add(const Eigen::VectorXd& r,
+                                              Eigen::VectorXd& w) const {
+  for (size_t k = 0; k < n_states; k++) {
+    w[idx.at(k, 0)] += r[idx.row(k, 0)];
+  }
+  for (size_t t = 0; t + 1 < N; t++) {
+    Eigen::Matrix<double, 6, 1> rt;
+    for (size_t k = 0; k < n_states; k++) {
+      rt[k] = r[idx.row(k, t + 1)];
+      w[idx.at(k, t + 1)] += rt[k];
+    }
+    Eigen::Matrix<double, 8, 1> Jr = J[t].transpose() * rt;
+    for (size_t j = 0; j < 8; j++) {
+      w[idx.at(j, t)] -= Jr[j];
+    }
+  }
+  for (size_t i = 0; i < fixed.size(); i++) {
+    w[fixed[i].first] += r[idx.n_constraints() + i];
+  }
+}
+
+std::vector<Eigen::Triplet<double>> StageConstraints::triplets() const {
+  typedef Eigen::Triplet<double> Triplet;
+  std::vector<Triplet> c;
+  for (size_t k = 0; k < n_states; k++) {
+    c.push_back(Triplet(idx.row(k, 0), idx.at(k, 0), 1.0));
+  }
+  for (size_t t = 0; t + 1 < N; t++) {
+    for (size_t k = 0; k < n_states; k++) {
+      size_t row = idx.row(k, t + 1);
+      c.push_back(Triplet(row, idx.at(k, t + 1), 1.0));
+      for (size_t j = 0; j < 8; j++) {
+        if (J[t](k, j) != 0) {
+          c.push_back(Triplet(row, idx.at(j, t), -J[t](k, j)));
+        }
+      }
+    }
+  }
+  for (size_t i = 0; i < fixed.size(); i++) {
+    c.push_back(Triplet(idx.n_constraints() + i, fixed[i].first, 1.0));
+  }
+  return c;
+}
+
+StageHessian::StageHessian(const Eigen::SparseMatrix<double>& H, size_t N, Layout layout) {
+  VarIndex idx(N, layout);
+  std::vector<size_t> stage(idx.n_vars()), position(idx.n_vars());
+  vars.resize(N);
+  diagonal.resize(N);
+  below.resize(N - 1);
+  for (size_t t = 0; t < N; t++) {
+    size_t size = t + 1 < N ? n_states + n_actuators : n_states;
+    for (size_t j = 0; j < size; j++) {
+      vars[t].push_back(idx.at(j, t));
+      stage[idx.at(j, t)] = t;
+      position[idx.at(j, t)] = j;
+    }
+    diagonal[t] = Eigen::MatrixXd::Zero(size, size);
+    if (t > 0) {
+      below[t - 1] = Eigen::MatrixXd::Zero(size, n_states + n_actuators);
+    }
+  }
+
+  for (int col = 0; col < H.outerSize(); col++) {
+    for (Eigen::SparseMatrix<double>::InnerIterator it(H, col); it; ++it) {
+      size_t ti = stage[it.row()], tj = stage[it.col()];
+      if (ti == tj) {
+        diagonal[ti](position[it.row()], position[it.col()]) = it.value();
+      } else if (ti == tj + 1) {
+        below[tj](position[it.row()], position[it.col()]) = it.value();
+      }
+    }
+  }
+}
+
+size_t StageHessian::size_bytes() const {
+  size_t bytes = 0;
+  for (const std::vector<size_t>& v : vars) {
+    bytes += v.size() * sizeof(size_t);
+  }
+  for (const Eigen::MatrixXd& m : diagonal) {
+    bytes += m.size() * sizeof(double);
+  }
+  for (const Eigen::MatrixXd& m : below) {
+    bytes += m.size() * sizeof(double);
+  }
+  return bytes;
+}
+
+void AugmentedKKT::multiply_add(const Eigen::VectorXd& src, Eigen::VectorXd& dst) const {
+  const size_t n = C.n_vars();
+  const size_t m = C.rows();
+  Eigen::VectorXd w = src.head(n);
+
+  // [H w + C'(l + rho C w); C w]
+  Eigen::VectorXd r;
+  C.multiply(w, r);
+  dst.tail(m) += r;
+
+  Eigen::VectorXd top = H * w;
+  C.multiply_transpose_add(src.tail(m) + rho * r, top);
+  dst.head(n) += top;
+}
+
+Eigen::VectorXd AugmentedKKT::rhs(const Eigen::VectorXd& q) const {
+  const size_t n = C.n_vars();
+  Eigen::VectorXd b = C.rhs();
+  Eigen::VectorXd r(n + b.size());
+  Eigen::VectorXd top = -q;
+  C.multiply_transpose_add(rho * b, top);
+  r.head(n) = top;
+  r.tail(b.size()) = b;
+  return r;
+}
+
+StagePreconditioner& StagePreconditioner::compute(const AugmentedKKT& K) {
+  const StageConstraints& C = K.C;
+  const size_t n_stages = C.n_stages();
+  n_vars = C.n_vars();
+  rho = K.rho;
+
+  // rho C'C has rho on the diagonal for every state (row block t) and
+  // every fixed actuation, rho J'J on the block of each stage feeding the
+  // next one, and -rho J between the states of t + 1 and stage t.
+  Eigen::VectorXd extra = Eigen::VectorXd::Zero(n_vars);
+  for (size_t i = 0; i < C.fixed.size(); i++) {
+    extra[C.fixed[i].first] += rho;
+  }
+
+  stage_vars = &K.blocks.vars;
+  const std::vector<std::vector<size_t>>& vars = *stage_vars;
+
+  // Block Cholesky: L[t] L[t]' = D[t] - M[t-1] M[t-1]' with
+  // M[t] = E[t] L[t]^-T and E[t] the block between stages t + 1 and t.
+  factors.resize(n_stages);
+  coupling.resize(n_stages - 1);
+  info_ = Eigen::Success;
+  for (size_t t = 0; t < n_stages; t++) {
+    Eigen::MatrixXd D = K.blocks.diagonal[t];
+    for (size_t i = 0; i < vars[t].size(); i++) {
+      D(i, i) += extra[vars[t][i]];
+    }
+    D.topLeftCorner(n_states, n_states).diagonal().array() += rho;
+    if (t + 1 < n_stages) {
+      D += rho * C.J[t].transpose() * C.J[t];
+    }
+    if (t > 0) {
+      D -= coupling[t - 1] * coupling[t - 1].transpose();
+    }
+
+    factors[t].compute(D);
+    if (factors[t].info() != Eigen::Success) {
+      info_ = Eigen::NumericalIssue;
+      return *this;
+    }
+
+    if (t + 1 < n_stages) {
+      Eigen::MatrixXd E = K.blocks.below[t];
+      E.topRows(n_states) -= rho * C.J[t].leftCols(vars[t].size());
+      // E L^-T, i.e. (L^-1 E')'
+      coupling[t] = factors[t].matrixL().solve(E.transpose()).transpose();
+    }
+  }
+  return *this;
+}
+
+void StagePreconditioner::apply(const Eigen::VectorXd& r, Eigen::VectorXd& x) const {
+  const std::vector<std::vector<size_t>>& vars = *stage_vars;
+  const size_t n_stages = vars.size();
+  x.resize(r.size());
+
+  // L y = r, forwards through the stages.
+  std::vector<Eigen::VectorXd> y(n_stages);
+  for (size_t t = 0; t < n_stages; t++) {
+    Eigen::VectorXd rt(vars[t].size());
+    for (size_t j = 0; j < vars[t].size(); j++) {
+      rt[j] = r[vars[t][j]];
+    }
+    if (t > 0) {
+      rt -= coupling[t - 1] * y[t - 1];
+    }
+    y[t] = factors[t].matrixL().solve(rt);
+  }
+
+  // L' x = y, backwards.
+  Eigen::VectorXd next;
+  for (size_t t = n_stages; t-- > 0;) {
+    if (t + 1 < n_stages) {
+      y[t] -= coupling[t].transpose() * next;
+    }
+    next = factors[t].matrixU().solve(y[t]);
+    for (size_t j = 0; j < vars[t].size(); j++) {
+      x[vars[t][j]] = next[j];
+    }
+  }
+
+  x.tail(r.size() - n_vars) = rho * r.tail(r.size() - n_vars);
+}
@@ -0,0 +1,195 @@
+#ifndef KKT_H
+#define KKT_H
+
+#include <utility>
+#include <vector>
+#include "Eigen-3.3/Eigen/Core"
+#include "Eigen-3.3/Eigen/Cholesky"
+#include "Eigen-3.3/Eigen/SparseCore"
+#include "problem.h"
+
+/*
+ Iterative solve of the RTI KKT system without assembling it.
+
+ The constraints are kept stage by stage: row block 0 pins the initial
+ state and row block t + 1 reads
+
+   s[t+1] - J[t] * [s[t]; u[t]] = b[t+1]
+
+ with the 6 states s and 2 actuations u of a timestep. Products with C and
+ C' walk the stages, so a long horizon costs O(N) per product and the KKT
+ matrix is never assembled.
+
+ MINRES needs a symmetric positive definite preconditioner, but H alone is
+ singular (x, y and psi are not penalised). The system is therefore solved
+ in augmented Lagrangian form, which has the same solution:
+
+   [H + rho C'C  C'] [w]   [-q + rho C'b]
+   [C            0 ] [l] = [b           ]
+
+ and preconditioned with diag(P, I / rho), P = H + rho C'C. P only couples
+ neighbouring stages, so it is factorised stage by stage with 8x8 blocks,
+ again in O(N). Dropping that coupling (a block-diagonal P) is cheaper per
+ iteration but needs a number of iterations growing with N, as information
+ then moves one stage per iteration.
+ */
+
+class StageConstraints {
+ public:
+  StageConstraints(size_t N, Layout layout);
+
+  // Jacobian of stage t + 1 against [x y psi v cte epsi delta a] at t.
+  std::vector<Eigen::Matrix<double, 6, 8>> J;
+
+  // Right hand side, indexed by VarIndex::row.
+  Eigen::VectorXd b;
+
+  // Actuations pinned to a value, as (variable, value). Their rows follow
+  // the model constraints.
+  std::vector<std::pair<size_t, double>> fixed;
+
+  size_t n_vars() const { return idx.n_vars(); }
+  size_t rows() const { return idx.n_constraints() + fixed.size(); }
+
+  // b followed by the fixed values.
+  Eigen::VectorXd rhs() const;
+
+  // r = C w
+  void multiply(const Eigen::VectorXd& w, Eigen::VectorXd& r) const;
+
+  // w += C' r
+  void multiply_transpose_add(const Eigen::VectorXd& r, Eigen::VectorXd& w) const;
+
+  // The same matrix, for the direct solvers.
+  std::vector<Eigen::Triplet<double>> triplets() const;
+
+  // Variables of timestep t: 8, or 6 for the last one.
+  size_t stage_size(size_t t) const { return t + 1 < N ? n_states + n_actuators : n_states; }
+  size_t var(size_t k, size_t t) const { return idx.at(k, t); }
+  size_t n_stages() const { return N; }
+
+ private:
+  size_t N;
+  VarIndex idx;
+};
+
+// The blocks of H the preconditioner below reads, stage by stage:
+// diagonal[t] on the variables of stage t and below[t] between those of
+// stages t + 1 and t. H never changes, so they are extracted once per
+// configuration (see ProblemStructure) rather than at every factorisation.
+struct StageHessian {
+  StageHessian() {}
+  StageHessian(const Eigen::SparseMatrix<double>& H, size_t N, Layout layout);
+
+  // The variables of each stage, in block order.
+  std::vector<std::vector<size_t>> vars;
+  std::vector<Eigen::MatrixXd> diagonal;
+  std::vector<Eigen::MatrixXd> below;
+
+  size_t size_bytes() const;
+};
+
+class AugmentedKKT;
+
+namespace Eigen {
+namespace internal {
+// Looks like a sparse matrix to the iterative solvers.
+template <>
+struct traits<AugmentedKKT> : public traits<Eigen::SparseMatrix<double>> {};
+}  // namespace internal
+}  // namespace Eigen
+
+// The augmented KKT matrix above as a matrix-free operator.
+class AugmentedKKT : public Eigen::EigenBase<AugmentedKKT> {
+ public:
+  typedef double Scalar;
+  typedef double RealScalar;
+  typedef int StorageIndex;
+  enum {
+    ColsAtCompileTime = Eigen::Dynamic,
+    MaxColsAtCompileTime = Eigen::Dynamic,
+    IsRowMajor = false
+  };
+
+  // blocks must be those of H.
+  AugmentedKKT(const Eigen::SparseMatrix<double>& H, const StageHessian& blocks,
+               const StageConstraints& C, double rho)
+      : H(H), blocks(blocks), C(C), rho(rho) {}
+
+  Index rows() const { return C.n_vars() + C.rows(); }
+  Index cols() const { return rows(); }
+
+  template <typename Rhs>
+  Eigen::Product<AugmentedKKT, Rhs, Eigen::AliasFreeProduct> operator*(
+      const Eigen::MatrixBase<Rhs>& x) const {
+    return Eigen::Product<AugmentedKKT, Rhs, Eigen::AliasFreeProduct>(*this, x.derived());
+  }
+
+  // dst += K * src
+  void multiply_add(const Eigen::VectorXd& src, Eigen::VectorXd& dst) const;
+
+  // [-q + rho C'b; b]
+  Eigen::VectorXd rhs(const Eigen::VectorXd& q) const;
+
+  const Eigen::SparseMatrix<double>& H;
+  const StageHessian& blocks;
+  const StageConstraints& C;
+  const double rho;
+};
+
+namespace Eigen {
+namespace internal {
+template <typename Rhs>
+struct generic_product_impl<AugmentedKKT, Rhs, SparseShape, DenseShape, GemvProduct>
+    : generic_product_impl_base<AugmentedKKT, Rhs, generic_product_impl<AugmentedKKT, Rhs>> {
+  typedef typename Product<AugmentedKKT, Rhs>::Scalar Scalar;
+
+  // The solvers only ever ask for dst += lhs * rhs.
+  template <typename Dest>
+  static void scaleAndAddTo(Dest& dst, const AugmentedKKT& lhs, const Rhs& rhs,
+                            const Scalar& alpha) {
+    eigen_assert(alpha == Scalar(1));
+    Eigen::VectorXd result = dst;
+    lhs.multiply_add(rhs, result);
+    dst = result;
+  }
+};
+}  // namespace internal
+}  // namespace Eigen
+
+// diag(P, I / rho) from above, inverted stage by stage by a block Cholesky
+// factorisation of P.
+class StagePreconditioner {
+ public:
+  typedef double Scalar;
+
+  StagePreconditioner() : stage_vars(nullptr), info_(Eigen::Success) {}
+
+  template <typename MatType>
+  StagePreconditioner& analyzePattern(const MatType&) { return *this; }
+  StagePreconditioner& factorize(const AugmentedKKT& K) { return compute(K); }
+  StagePreconditioner& compute(const AugmentedKKT& K);
+
+  template <typename Rhs>
+  Eigen::VectorXd solve(const Rhs& r) const {
+    Eigen::VectorXd x;
+    apply(r, x);
+    return x;
+  }
+
+  Eigen::ComputationInfo info() { return info_; }
+
+ private:
+  void apply(const Eigen::VectorXd& r, Eigen::VectorXd& x) const;
+
+  // Per stage: its variables (from StageHessian), the Cholesky factor of
+  // its diagonal block and its coupling to the next stage (see compute()).
+  const std::vector<std::vector<size_t>>* stage_vars;
+  std::vector<Eigen::LLT<Eigen::MatrixXd>> factors;
+  std::vector<Eigen::MatrixXd> coupling;
+  size_t n_vars;
+  double rho;
+  Eigen::ComputationInfo info_;
+};
+
+#endif /* KKT_H */
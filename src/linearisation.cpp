@@ -0,0 +1,246 @@
+#include "linearisation.h"
+#include <cmath>
+#include "Eigen-3.3/unsupported/Eigen/AutoDiff"
+#include "Eigen-3.3/unsupported/Eigen/MatrixFunctions"
+#include "problem.h"
+
+// Scalar carrying the value and the derivatives with respect to
+// [x y psi v delta a].
+typedef Eigen::AutoDiffScalar<Eigen::Matrix<double, 6, 1>> ADScalar;
+
+StageLinearisation linearise_step(const Eigen::Vector4d& s, const Eigen::Vector2d& u,
+                                  double dt, Integrator integrator) {
+  VehicleState<ADScalar> state = {ADScalar(s[0], 6, 0), ADScalar(s[1], 6, 1),
+                                  ADScalar(s[2], 6, 2), ADScalar(s[3], 6, 3)};
+  ADScalar delta(u[0], 6, 4);
+  ADScalar a(u[1], 6, 5);
+
+  VehicleState<ADScalar> next = step(state, delta, a, dt, integrator);
+  const ADScalar* rows[4] = {&next.x, &next.y, &next.psi, &next.v};
+
+  StageLinearisation lin;
+  lin.s0 = s;
+  lin.u0 = u;
+  for (int i = 0; i < 4; i++) {
+    lin.next[i] = rows[i]->value();
+    lin.A.row(i) = rows[i]->derivatives().head<4>().transpose();
+    lin.B.row(i) = rows[i]->derivatives().tail<2>().transpose();
+  }
+  return lin;
+}
+
+StageLinearisation to_frame(const StageLinearisation& lin, const Eigen::Vector3d& origin) {
+  double c = cos(origin[2]);
+  double s = sin(origin[2]);
+
+  // Linear part of the change of frame: rotate positions, keep psi and v.
+  Eigen::Matrix4d T = Eigen::Matrix4d::Identity();
+  T.topLeftCorner<2, 2>() << c, s, -s, c;
+
+  auto point = [&](const Eigen::Vector4d& p) {
+    Eigen::Vector4d shifted = p;
+    shifted[0] -= origin[0];
+    shifted[1] -= origin[1];
+    shifted[2] -= origin[2];
+    return Eigen::Vector4d(T * shifted);
+  };
+
+  StageLinearisation moved;
+  moved.s0 = point(lin.s0);
+  moved.u0 = lin.u0;
+  moved.next = point(lin.next);
+  moved.A = T * lin.A * T.transpose();
+  moved.B = T * lin.B;
+  return moved;
+}
+
+double poly(const Eigen::VectorXd& coeffs, double x, int derivative) {
+  double result = 0.0;
+  for (int i = coeffs.size() - 1; i >= derivative; i--) {
+    double factor = 1.0;
+    for (int k = 0; k < derivative; k++) {
+      factor *= i - k;
+    }
+    result = result * x + factor * coeffs[i];
+  }
+  return result;
+}
+
+void linearise_stage(const Eigen::Matrix<double, 8, 1>& z, const StageLinearisation& lin,
+                     const Eigen::VectorXd& coeffs, double dt, Integrator integrator,
+                     Eigen::Matrix<double, 6, 1>& value, Eigen::Matrix<double, 6, 8>& J) {
+  Eigen::Vector4d s = z.head<4>();
+  Eigen::Vector2d u = z.tail<2>();
+  double epsi0 = z[5];
+  Eigen::Vector4d next = lin.next + lin.A * (s - lin.s0) + lin.B * (u - lin.u0);
+
+  // Rows of [x y psi v cte epsi] at t + 1 against [x y psi v cte epsi]
+  // and [delta a] at t.
+  J.setZero();
+  J.topLeftCorner<4, 4>() = lin.A;
+  J.topRightCorner<4, 2>() = lin.B;
+  value.head<4>() = next;
+
+  if (integrator == Integrator::EULER) {
+    // cte[t+1] = f(x[t]) - y[t] + v[t] * sin(epsi[t]) * dt
+    // epsi[t+1] = psi[t] - atan(f'(x[t])) + v[t] * delta[t] / Lf * dt
+    double f1 = poly(coeffs, s[0], 1);
+    double f2 = poly(coeffs, s[0], 2);
+    value[4] = poly(coeffs, s[0], 0) - s[1] + s[3] * sin(epsi0) * dt;
+    J(4, 0) = f1;
+    J(4, 1) = -1;
+    J(4, 3) = sin(epsi0) * dt;
+    J(4, 5) = s[3] * cos(epsi0) * dt;
+
+    value[5] = s[2] - atan(f1) + s[3] * u[0] / Lf * dt;
+    J(5, 0) = -f2 / (1 + f1 * f1);
+    J(5, 2) = 1;
+    J(5, 3) = u[0] / Lf * dt;
+    J(5, 6) = s[3] / Lf * dt;
+  } else {
+    // cte[t+1] = f(x[t+1]) - y[t+1]
+    // epsi[t+1] = psi[t+1] - atan(f'(x[t+1]))
+    double f1 = poly(coeffs, next[0], 1);
+    double f2 = poly(coeffs, next[0], 2);
+    value[4] = poly(coeffs, next[0], 0) - next[1];
+    J.row(4) = f1 * J.row(0) - J.row(1);
+
+    value[5] = next[2] - atan(f1);
+    J.row(5) = J.row(2) - f2 / (1 + f1 * f1) * J.row(0);
+  }
+}
+
+LinearisationTable::LinearisationTable(double dt, size_t n_psi, size_t n_v, size_t n_delta)
+    : n_psi(n_psi), n_v(n_v), n_delta(n_delta), owned(size()) {
+  set_grid();
+  data = owned.data();
+
+  for (size_t i = 0; i < n_psi; i++) {
+    double psi = -M_PI + i * psi_step;
+    for (size_t j = 0; j < n_v; j++) {
+      double v = v_min + j * v_step;
+      for (size_t k = 0; k < n_delta; k++) {
+        double delta = delta_min + k * delta_step;
+
+        // [Ac Bc; 0 0] of x' = v cos(psi), y' = v sin(psi),
+        // psi' = v * delta / Lf, v' = a.
+        Eigen::Matrix<double, 6, 6> M = Eigen::Matrix<double, 6, 6>::Zero();
+        M(0, 2) = -v * sin(psi);
+        M(0, 3) = cos(psi);
+        M(1, 2) = v * cos(psi);
+        M(1, 3) = sin(psi);
+        M(2, 3) = delta / Lf;
+        M(2, 4) = v / Lf;
+        M(3, 5) = 1;
+        Eigen::Matrix<double, 6, 6> E = (M * dt).exp();
+
+        double* entry = &owned[((i * n_v + j) * n_delta + k) * entry_size];
+        Eigen::Map<Eigen::Matrix4d> A(entry);
+        Eigen::Map<Eigen::Matrix<double, 4, 2>> B(entry + 16);
+        A = E.topLeftCorner<4, 4>();
+        B = E.block<4, 2>(0, 4);
+      }
+    }
+  }
+}
+
+LinearisationTable::LinearisationTable(size_t n_psi, size_t n_v, size_t n_delta,
+                                       const double* values,
+                                       std::shared_ptr<const void> storage)
+    : n_psi(n_psi), n_v(n_v), n_delta(n_delta), data(values), storage(storage) {
+  set_grid();
+}
+
+void LinearisationTable::set_grid() {
+  // Reversing a little up to twice the reference speed.
+  v_min = -5;
+  v_step = (2 * ref_v - v_min) / (n_v - 1);
+  delta_min = -max_delta;
+  delta_step = 2 * max_delta / (n_delta - 1);
+  psi_step = 2 * M_PI / n_psi;
+}
+
+void LinearisationTable::lookup(double psi, double v, double delta, Eigen::Matrix4d& A,
+                                Eigen::Matrix<double, 4, 2>& B) const {
+  // Grid co-ordinates and the weight of the upper neighbour along each axis.
+  double p = (psi + M_PI) / psi_step;
+  p -= n_psi * floor(p / n_psi);
+  size_t i0 = static_cast<size_t>(p) % n_psi;
+  size_t i1 = (i0 + 1) % n_psi;
+  double wi = p - floor(p);
+
+  double q = std::max(0.0, std::min((v - v_min) / v_step, n_v - 1.0));
+  size_t j0 = std::min(static_cast<size_t>(q), n_v - 2);
+  double wj = q - j0;
+
+  double r = std::max(0.0, std::min((delta - delta_min) / delta_step, n_delta - 1.0));
+  size_t k0 = std::min(static_cast<size_t>(r), n_delta - 2);
+  double wk = r - k0;
+
+  double entry[entry_size] = {0};
+  size_t is[2] = {i0, i1};
+  double wis[2] = {1 - wi, wi};
+  double wjs[2] = {1 - wj, wj};
+  double wks[2] = {1 - wk, wk};
+  for (int a = 0; a < 2; a++) {
+    for (int b = 0; b < 2; b++) {
+      // The two delta neighbours are adjacent in memory.
+      const double* corner = &data[((is[a] * n_v + j0 + b) * n_delta + k0) * entry_size];
+      double w0 = wis[a] * wjs[b] * wks[0];
+      double w1 = wis[a] * wjs[b] * wks[1];
+      for (size_t e = 0; e < entry_size; e++) {
+        entry[e] += w0 * corner[e] + w1 * corner[entry_size + e];
+      }
+    }
+  }
+  A = Eigen::Map<Eigen::Matrix4d>(entry);
+  B = Eigen::Map<Eigen::Matrix<double, 4, 2>>(entry + 16);
+}
+
+LinearisationCache::LinearisationCache(size_t n_stages, double dt, Integrator integrator,
+                                       double tolerance, const LinearisationTable* table)
+    : dt(dt), integrator(integrator), tolerance(tolerance), table(table),
+      stages(n_stages), valid(n_stages, false), n_evaluated(0), n_reused(0) {}
+
+void LinearisationCache::shift(const Eigen::Vector3d& origin, size_t n) {
+  for (size_t t = 0; t < stages.size(); t++) {
+    valid[t] = t + n < stages.size() && valid[t + n];
+    if (valid[t]) {
+      stages[t] = to_frame(stages[t + n], origin);
+    }
+  }
+  n_evaluated = 0;
+  n_reused = 0;
+}
+
+void LinearisationCache::clear() {
+  valid.assign(valid.size(), false);
+  n_evaluated = 0;
+  n_reused = 0;
+}
+
+const StageLinearisation& LinearisationCache::get(size_t t, const Eigen::Vector4d& s,
+                                                  const Eigen::Vector2d& u) {
+  if (valid[t]) {
+    double moved = std::max((s - stages[t].s0).cwiseAbs().maxCoeff(),
+                            (u - stages[t].u0).cwiseAbs().maxCoeff());
+    if (moved <= tolerance) {
+      n_reused++;
+      return stages[t];
+    }
+  }
+  if (table) {
+    StageLinearisation& lin = stages[t];
+    VehicleState<double> next = step(VehicleState<double>{s[0], s[1], s[2], s[3]},
+                                     u[0], u[1], dt, integrator);
+    lin.s0 = s;
+    lin.u0 = u;
+    lin.next << next.x, next.y, next.psi, next.v;
+    table->lookup(s[2], s[3], u[0], lin.A, lin.B);
+  } else {
+    stages[t] = linearise_step(s, u, dt, integrator);
+  }
+  valid[t] = true;
+  n_evaluated++;
+  return stages[t];
+}
@@ -0,0 +1,137 @@
+#ifndef LINEARISATION_H
+#define LINEARISATION_H
+
+#include <memory>
+#include <vector>
+#include "Eigen-3.3/Eigen/Core"
+#include "model.h"
+
+// One step of the vehicle model (x, y, psi, v) linearised around an
+// operating point (s0, u0):
+//
+//   step(s, u) ~ next + A * (s - s0) + B * (u - u0)
+struct StageLinearisation {
+  Eigen::Vector4d s0;
+  Eigen::Vector2d u0;
+  Eigen::Vector4d next;
+  Eigen::Matrix4d A;
+  Eigen::Matrix<double, 4, 2> B;
+};
+
+// Evaluate the model and its Jacobians at (s, u) with forward-mode AD over
+// the shared model code.
+StageLinearisation linearise_step(const Eigen::Vector4d& s, const Eigen::Vector2d& u,
+                                  double dt, Integrator integrator);
+
+// The reference polynomial or one of its derivatives at x.
+double poly(const Eigen::VectorXd& coeffs, double x, int derivative);
+
+// One stage of the full model, [x y psi v cte epsi] at t + 1 as a function
+// of z = [x y psi v cte epsi delta a] at t, as in FG_eval: Euler uses the
+// classroom cte/epsi update, the other integrators measure cte and epsi
+// against the reference at the propagated state. The vehicle part comes
+// from lin, which may have been taken at a nearby point. Sets the value at
+// z and the Jacobian.
+void linearise_stage(const Eigen::Matrix<double, 8, 1>& z, const StageLinearisation& lin,
+                     const Eigen::VectorXd& coeffs, double dt, Integrator integrator,
+                     Eigen::Matrix<double, 6, 1>& value, Eigen::Matrix<double, 6, 8>& J);
+
+// Express a linearisation in the frame whose origin is at (x, y, psi) of
+// its current frame. The model is invariant under moving and rotating the
+// frame, so this is exact and much cheaper than linearising again.
+StageLinearisation to_frame(const StageLinearisation& lin, const Eigen::Vector3d& origin);
+
+/*
+ Discrete-time A/B matrices of the vehicle model, precomputed over a grid
+ of operating points.
+
+ The continuous-time Jacobians only depend on (psi, v, delta), so each grid
+ point holds the exact zero-order-hold discretisation exp([Ac Bc; 0 0] dt)
+ of the model linearised there. lookup() interpolates trilinearly between
+ the 8 surrounding points, which sit next to each other in one contiguous
+ array. psi wraps around; v and delta are clamped to the grid.
+ */
+class LinearisationTable {
+ public:
+  LinearisationTable(double dt, size_t n_psi = 72, size_t n_v = 24, size_t n_delta = 9);
+
+  // A table over values computed earlier by the constructor above, e.g.
+  // mapped from a file (see structure_cache.h). storage keeps them alive.
+  LinearisationTable(size_t n_psi, size_t n_v, size_t n_delta, const double* values,
+                     std::shared_ptr<const void> storage);
+
+  void lookup(double psi, double v, double delta, Eigen::Matrix4d& A,
+              Eigen::Matrix<double, 4, 2>& B) const;
+
+  size_t size_bytes() const { return size() * sizeof(double); }
+
+  // The grid and the raw values, for writing the table out.
+  size_t size() const { return n_psi * n_v * n_delta * entry_size; }
+  const double* values() const { return data; }
+  size_t psi_points() const { return n_psi; }
+  size_t v_points() const { return n_v; }
+  size_t delta_points() const { return n_delta; }
+
+ private:
+  // A (4x4) followed by B (4x2), both column-major.
+  static const size_t entry_size = 24;
+
+  size_t n_psi, n_v, n_delta;
+  double v_min, v_step;
+  double delta_min, delta_step;
+  double psi_step;
+
+  void set_grid();
+
+  // Grid point (psi, v, delta) at ((i_psi * n_v + i_v) * n_delta + i_delta)
+  // * entry_size, in owned or in storage.
+  const double* data;
+  std::vector<double> owned;
+  std::shared_ptr<const void> storage;
+};
+
+/*
+ Per-stage linearisations kept from one frame to the next.
+
+ Consecutive frames linearise along almost the same trajectory, shifted by
+ the time between them and seen from the car's new position. shift()
+ moves every stage forward by the nearest whole number of timesteps and
+ into the new frame; get() then only linearises again the stages whose
+ operating point moved by more than the tolerance (which a shift by a
+ fraction of a timestep may well cause), and the new last stages.
+ */
+class LinearisationCache {
+ public:
+  // With a table, A and B are looked up instead of differentiating the
+  // model; the model value still comes from the configured integrator.
+  LinearisationCache(size_t n_stages, double dt, Integrator integrator, double tolerance,
+                     const LinearisationTable* table = nullptr);
+
+  // Stage t takes over stage t + n, seen from the frame whose origin is at
+  // (x, y, psi) of the current one. The last n stages are left empty.
+  void shift(const Eigen::Vector3d& origin, size_t n = 1);
+
+  // Forget every stage.
+  void clear();
+
+  // Linearisation of stage t valid around (s, u).
+  const StageLinearisation& get(size_t t, const Eigen::Vector4d& s, const Eigen::Vector2d& u);
+
+  // Stages linearised and reused since the last shift() or clear().
+  size_t evaluated() const { return n_evaluated; }
+  size_t reused() const { return n_reused; }
+
+ private:
+  double dt;
+  Integrator integrator;
+  double tolerance;
+  const LinearisationTable* table;
+
+  std::vector<StageLinearisation> stages;
+  std::vector<bool> valid;
+
+  size_t n_evaluated;
+  size_t n_reused;
+};
+
+#endif /* LINEARISATION_H */
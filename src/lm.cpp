@@ -0,0 +1,307 @@
+#include "lm.h"
+#include <algorithm>
+#include <cmath>
+#include "Eigen-3.3/Eigen/SparseCore"
+#include "Eigen-3.3/unsupported/Eigen/LevenbergMarquardt"
+#include "linearisation.h"
+#include "rti.h"
+
+namespace {
+
+// Model constraints are met once no state is off by more than this.
+const double feasibility_tolerance = 1e-4;
+const int max_rounds = 10;
+
+// Larger values make the first rounds badly conditioned and need many more
+// iterations; 1e4 already fails to converge on some frames.
+const double initial_mu = 1e2;
+
+// Two limits per actuation: upper then lower.
+size_t n_bounds(size_t N) { return 2 * n_actuators * (N - 1); }
+
+// State k = 3 of [x y psi v cte epsi]: its update v[t+1] = v[t] + a[t] * dt
+// is linear for every integrator.
+const size_t v_state = 3;
+
+/*
+ Residuals of one augmented Lagrangian round, in this order:
+
+   the cost terms, linear in w: cost_matrix * w - cost_target
+   sqrt(mu) * (g + lambda / mu), at VarIndex::row
+   sqrt(mu) * max(0, h + nu / mu)
+
+ The entries of the Jacobian that do not depend on w come from
+ constant_jacobian(). They are copied into the Levenberg-Marquardt
+ Jacobian once per round, on the first df(), since Eigen's solver keeps
+ that matrix between iterations (the QR works on a copy). Every df()
+ after that only overwrites the linearised model and the bound rows.
+ */
+class AugmentedLagrangian : public Eigen::DenseFunctor<double> {
+ public:
+  AugmentedLagrangian(const MPCConfig& config, const VarIndex& idx,
+                      const Eigen::SparseMatrix<double>& cost_matrix,
+                      const Eigen::VectorXd& cost_target, const Eigen::MatrixXd& constant_jacobian,
+                      const Eigen::VectorXd& state, const Eigen::VectorXd& coeffs,
+                      const Eigen::VectorXd& lambda, const Eigen::VectorXd& nu, double mu)
+      : DenseFunctor<double>(idx.n_vars(), cost_matrix.rows() + idx.n_constraints() +
+                                                     n_bounds(config.N)),
+        config(config),
+        idx(idx),
+        cost_matrix(cost_matrix),
+        cost_target(cost_target),
+        constant_jacobian(constant_jacobian),
+        state(state),
+        coeffs(coeffs),
+        lambda(lambda),
+        nu(nu),
+        mu(mu) {}
+
+  int operator()(const InputType& w, ValueType& r) const {
+    size_t n_cost = cost_matrix.rows();
+    r.head(n_cost) = cost_matrix * w - cost_target;
+
+    Eigen::VectorXd g = constraints(w);
+    r.segment(n_cost, g.size()) = sqrt(mu) * (g + lambda / mu);
+
+    Eigen::VectorXd h = bounds(w);
+    r.tail(h.size()) = sqrt(mu) * (h + nu / mu).cwiseMax(0.0);
+    return 0;
+  }
+
+  int df(const InputType& w, JacobianType& jac) const {
+    const size_t N = config.N;
+    const size_t n_cost = cost_matrix.rows();
+    const size_t n_constraints = idx.n_constraints();
+    const double scale = sqrt(mu);
+
+    if (jac.data() != prepared || jac.rows() != constant_jacobian.rows() ||
+        jac.cols() != constant_jacobian.cols()) {
+      jac = constant_jacobian;
+      jac.middleRows(n_cost, n_constraints) *= scale;
+      prepared = jac.data();
+    }
+
+    for (size_t t = 0; t + 1 < N; t++) {
+      Eigen::Matrix<double, 8, 1> z = stage(w, t);
+      StageLinearisation lin = linearise_step(z.head<4>(), z.tail<2>(), config.dt,
+                                              config.integrator);
+      Eigen::Matrix<double, 6, 1> value;
+      Eigen::Matrix<double, 6, 8> J;
+      linearise_stage(z, lin, coeffs, config.dt, config.integrator, value, J);
+      for (size_t k = 0; k < n_states; k++) {
+        if (k == v_state) {
+          continue;
+        }
+        size_t row = n_cost + idx.row(k, t + 1);
+        for (size_t c = 0; c < n_states + n_actuators; c++) {
+          jac(row, idx.at(c, t)) = -scale * J(k, c);
+        }
+      }
+    }
+
+    Eigen::VectorXd h = bounds(w);
+    for (size_t b = 0; b < n_bounds(N); b++) {
+      double active = h[b] + nu[b] / mu > 0 ? scale : 0;
+      jac(n_cost + n_constraints + b, bound_var(b)) = b % 2 ? -active : active;
+    }
+    return 0;
+  }
+
+  // g(w), indexed by VarIndex::row.
+  Eigen::VectorXd constraints(const Eigen::VectorXd& w) const {
+    Eigen::VectorXd g(idx.n_constraints());
+    for (size_t k = 0; k < n_states; k++) {
+      g[idx.row(k, 0)] = w[idx.at(k, 0)] - state[k];
+    }
+    for (size_t t = 0; t + 1 < config.N; t++) {
+      // Only the value is needed, so the vehicle part is a zero-order
+      // "linearisation" at z.
+      Eigen::Matrix<double, 8, 1> z = stage(w, t);
+      VehicleState<double> next =
+          step(VehicleState<double>{z[0], z[1], z[2], z[3]}, z[6], z[7], config.dt,
+               config.integrator);
+      StageLinearisation lin;
+      lin.s0 = z.head<4>();
+      lin.u0 = z.tail<2>();
+      lin.next << next.x, next.y, next.psi, next.v;
+      lin.A.setZero();
+      lin.B.setZero();
+
+      Eigen::Matrix<double, 6, 1> value;
+      Eigen::Matrix<double, 6, 8> J;
+      linearise_stage(z, lin, coeffs, config.dt, config.integrator, value, J);
+      for (size_t k = 0; k < n_states; k++) {
+        g[idx.row(k, t + 1)] = w[idx.at(k, t + 1)] - value[k];
+      }
+    }
+    return g;
+  }
+
+  // h(w) <= 0, the actuator limits.
+  Eigen::VectorXd bounds(const Eigen::VectorXd& w) const {
+    Eigen::VectorXd h(n_bounds(config.N));
+    for (size_t b = 0; b < n_bounds(config.N); b++) {
+      double u = w[bound_var(b)];
+      double limit = (b / 2) % 2 ? max_a : max_delta;
+      h[b] = b % 2 ? -limit - u : u - limit;
+    }
+    return h;
+  }
+
+ private:
+  const MPCConfig& config;
+  const VarIndex& idx;
+  const Eigen::SparseMatrix<double>& cost_matrix;
+  const Eigen::VectorXd& cost_target;
+  const Eigen::MatrixXd& constant_jacobian;
+
+  // The Jacobian that already holds the constant entries, if any.
+  mutable const double* prepared = nullptr;
+  const Eigen::VectorXd& state;
+  const Eigen::VectorXd& coeffs;
+  const Eigen::VectorXd& lambda;
+  const Eigen::VectorXd& nu;
+  const double mu;
+
+  Eigen::Matrix<double, 8, 1> stage(const Eigen::VectorXd& w, size_t t) const {
+    Eigen::Matrix<double, 8, 1> z;
+    for (size_t k = 0; k < n_states + n_actuators; k++) {
+      z[k] = w[idx.at(k, t)];
+    }
+    return z;
+  }
+
+  // Bound b limits actuation (b / 2) % 2 of timestep b / 4.
+  size_t bound_var(size_t b) const { return idx.at(n_states + (b / 2) % 2, b / 4); }
+};
+
+}  // namespace
+
+Eigen::MatrixXd constant_jacobian(const MPCConfig& config, const VarIndex& idx,
+                                  const Eigen::SparseMatrix<double>& cost_matrix) {
+  const size_t N = config.N;
+  const size_t n_cost = cost_matrix.rows();
+  Eigen::MatrixXd jac = Eigen::MatrixXd::Zero(n_cost + idx.n_constraints() + n_bounds(N),
+                                              idx.n_vars());
+  jac.topRows(n_cost) = cost_matrix;
+
+  for (size_t k = 0; k < n_states; k++) {
+    jac(n_cost + idx.row(k, 0), idx.at(k, 0)) = 1;
+  }
+  for (size_t t = 0; t + 1 < N; t++) {
+    for (size_t k = 0; k < n_states; k++) {
+      jac(n_cost + idx.row(k, t + 1), idx.at(k, t + 1)) = 1;
+    }
+    size_t row = n_cost + idx.row(v_state, t + 1);
+    jac(row, idx.v(t)) = -1;
+    jac(row, idx.a(t)) = -config.dt;
+  }
+  return jac;
+}
+
+LMSolver::LMSolver(const ProblemStructure& structure)
+    : config(structure.config), idx(structure.idx), cost_matrix(structure.cost_matrix),
+      cost_target(structure.cost_target), jacobian(structure.lm_jacobian),
+      previous(Eigen::VectorXd::Zero(idx.n_vars())),
+      lambda(Eigen::VectorXd::Zero(idx.n_constraints())),
+      nu(Eigen::VectorXd::Zero(n_bounds(config.N))), warm(false), last_cost(0), last_iterations(0),
+      last_rounds(0) {}
+
+void LMSolver::Seed(const LMSolver& nominal) {
+  previous = nominal.previous;
+  lambda = nominal.lambda;
+  nu = nominal.nu;
+  warm = nominal.warm;
+  last_cost = nominal.last_cost;
+  last_iterations = 0;
+  last_rounds = 0;
+}
+
+vector<double> LMSolver::Solve(const Eigen::VectorXd& state, const Eigen::VectorXd& coeffs,
+                               double elapsed) {
+  const size_t N = config.N;
+  const size_t n_constraints = idx.n_constraints();
+  const size_t bounds = n_bounds(N);
+
+  Eigen::VectorXd w;
+  if (warm && elapsed < config.dt * (N - 1)) {
+    Eigen::Vector3d origin;
+    w = shift_solution(previous, config, elapsed, origin);
+
+    // The multipliers of timestep t + n become those of t, n the nearest
+    // whole number of timesteps gone by; the last ones are kept.
+    const size_t n = static_cast<size_t>(lround(std::max(0.0, elapsed / config.dt)));
+    Eigen::VectorXd shifted = lambda;
+    for (size_t t = 0; t + n < N; t++) {
+      for (size_t k = 0; k < n_states; k++) {
+        shifted[idx.row(k, t)] = lambda[idx.row(k, t + n)];
+      }
+    }
+    lambda = shifted;
+    size_t per_step = 2 * n_actuators;
+    nu.head(bounds - n * per_step) = Eigen::VectorXd(nu.tail(bounds - n * per_step));
+  } else {
+    w = coasting_solution(state, config);
+    lambda = Eigen::VectorXd::Zero(n_constraints);
+    nu = Eigen::VectorXd::Zero(bounds);
+  }
+  for (size_t k = 0; k < n_states; k++) {
+    w[idx.at(k, 0)] = state[k];
+  }
+
+  last_iterations = 0;
+  last_rounds = 0;
+  double mu = initial_mu;
+  double previous_violation = INFINITY;
+  for (int round = 0; round < max_rounds; round++) {
+    AugmentedLagrangian f(config, idx, cost_matrix, cost_target, jacobian, state, coeffs,
+                          lambda, nu, mu);
+    Eigen::LevenbergMarquardt<AugmentedLagrangian> lm(f);
+    lm.minimize(w);
+    last_iterations += lm.iterations();
+    last_rounds++;
+
+    Eigen::VectorXd g = f.constraints(w);
+    Eigen::VectorXd h = f.bounds(w);
+    lambda += mu * g;
+    nu = (nu + mu * h).cwiseMax(0.0);
+
+    double violation = std::max(g.cwiseAbs().maxCoeff(), h.maxCoeff());
+    if (violation < feasibility_tolerance) {
+      break;
+    }
+    if (violation > 0.25 * previous_violation) {
+      mu *= 10;
+    }
+    previous_violation = violation;
+  }
+
+  warm = w.allFinite();
+  if (!warm) {
+    w = coasting_solution(state, config);
+  }
+
+  // Stay within the limits even if the rounds ran out.
+  for (size_t t = 0; t < N - 1; t++) {
+    w[idx.delta(t)] = std::max(-max_delta, std::min(max_delta, w[idx.delta(t)]));
+    w[idx.a(t)] = std::max(-max_a, std::min(max_a, w[idx.a(t)]));
+  }
+
+  previous = w;
+  last_cost = 0.5 * (cost_matrix * w - cost_target).squaredNorm();
+
+  vector<double> result;
+
+  // Return the first actuator values.
+  result.push_back(w[idx.delta(0)]);
+  result.push_back(w[idx.a(0)]);
+
+  // Return the predicted path
+  for (size_t i = 0; i < N - 1; i++)
+    result.push_back(w[idx.x(i + 1)]);
+
+  for (size_t i = 0; i < N - 1; i++)
+    result.push_back(w[idx.y(i + 1)]);
+
+  return result;
+}
@@ -0,0 +1,88 @@
+#ifndef LM_H
+#define LM_H
+
+#include <vector>
+#include "Eigen-3.3/Eigen/Core"
+#include "Eigen-3.3/Eigen/SparseCore"
+#include "MPC.h"
+#include "problem.h"
+#include "structure.h"
+
+/*
+ Augmented Lagrangian solve with Levenberg-Marquardt, without Ipopt.
+
+ The cost is a sum of squares. The model constraints g(w) = 0 and the
+ actuator limits h(w) <= 0 are added as penalties
+
+   mu / 2 * |g + lambda / mu|^2 + mu / 2 * |max(0, h + nu / mu)|^2
+
+ which are sums of squares as well, so each round is a nonlinear least
+ squares problem for Eigen's LevenbergMarquardt. After each round the
+ multipliers lambda and nu are updated and mu is raised if the constraints
+ did not improve enough.
+
+ The Jacobian is a dense matrix, factorised by the dense QR: Eigen's
+ sparse Levenberg-Marquardt path (SparseQR) is about twice as slow on
+ these sizes and asserts on the structurally rank deficient R some frames
+ produce.
+
+ The solution and the multipliers of the previous frame, shifted by the
+ time since then, are the starting point of the next one.
+ */
+// The entries of the residual Jacobian that are the same at every
+// iteration and every frame, with the model constraint rows for mu = 1:
+// the cost rows, the 1 of every state in its own constraint row, and the
+// v update v[t+1] = v[t] + a[t] * dt. Everything else (the linearised
+// model and the bounds) is added per iteration. Built once per
+// configuration, into ProblemStructure::lm_jacobian.
+Eigen::MatrixXd constant_jacobian(const MPCConfig& config, const VarIndex& idx,
+                                  const Eigen::SparseMatrix<double>& cost_matrix);
+
+class LMSolver {
+ public:
+  // structure must outlive the solver.
+  explicit LMSolver(const ProblemStructure& structure);
+
+  // Same arguments and result layout as MPC::Solve. elapsed must not be
+  // negative.
+  vector<double> Solve(const Eigen::VectorXd& state, const Eigen::VectorXd& coeffs,
+                       double elapsed);
+
+  // Forget the previous solution and multipliers; see RTISolver::Reset.
+  void Reset() { warm = false; }
+
+  // Take over the previous solution and multipliers of nominal; see
+  // RTISolver::Seed.
+  void Seed(const LMSolver& nominal);
+
+  // Cost of the last solution.
+  double cost() const { return last_cost; }
+
+  // Levenberg-Marquardt iterations and augmented Lagrangian rounds of the
+  // last solve.
+  size_t iterations() const { return last_iterations; }
+  size_t rounds() const { return last_rounds; }
+
+ private:
+  const MPCConfig& config;
+  const VarIndex& idx;
+
+  // The cost is |cost_matrix * w - cost_target|^2 / 2.
+  const Eigen::SparseMatrix<double>& cost_matrix;
+  const Eigen::VectorXd& cost_target;
+
+  // constant_jacobian() of this configuration.
+  const Eigen::MatrixXd& jacobian;
+
+  // Previous solution and multipliers.
+  Eigen::VectorXd previous;
+  Eigen::VectorXd lambda;
+  Eigen::VectorXd nu;
+  bool warm;
+
+  double last_cost;
+  size_t last_iterations;
+  size_t last_rounds;
+};
+
+#endif /* LM_H */
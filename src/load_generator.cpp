@@ -0,0 +1,288 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "busy_poll.h"
+#include "json.hpp"
+#include "model.h"
+#include "websocket.h"
+
+/*
+ Load generator for the servers.
+
+ Opens C WebSocket connections, each one a simulated car on a winding
+ road, and drives them in closed loop for a while: every connection sends
+ telemetry the way the simulator does, waits for the steering reply,
+ applies it and sends the next frame. Reports the round-trip time
+ distribution and the throughput.
+
+ With --fleet V every connection carries V cars instead, in fleet frames
+ (see fleet.h), and the throughput is also given in vehicles.
+
+ Each reply normally moves the cars on by one 100 ms frame, whatever the
+ round trip took. With --real-time they move on by the time that actually
+ passed, under the actuations in force until the reply came: the server's
+ latency compensation then only holds while the round trip is close to the
+ latency it predicts over, e.g. behind mpc_netem. The cross track errors
+ show how well the cars keep to the road either way.
+
+ Start the server without the simulated actuation latency to measure the
+ server rather than the sleep, e.g.
+
+   ./mpc --latency-ms 0 &      or      ./mpc_uring --latency-ms 0 &
+   ./mpc_load --connections 64 --seconds 10
+
+ Usage: mpc_load [--host a.b.c.d] [--port p] [--connections C]
+                 [--seconds s] [--fleet V] [--real-time]
+ */
+
+using json = nlohmann::json;
+
+namespace {
+
+double road(double x) { return 8 * sin(x / 40); }
+
+struct Client {
+  int fd = -1;
+  bool upgraded = false;
+  std::string key;
+  std::string input;
+  // One car, or the cars of a fleet, spread out along the road.
+  std::vector<VehicleState<double>> cars;
+  // The actuations of each car since its last reply.
+  std::vector<double> delta;
+  std::vector<double> a;
+  std::chrono::steady_clock::time_point sent;
+};
+
+// Move car on by seconds under delta and a.
+void drive(VehicleState<double>& car, double delta, double a, double seconds) {
+  for (double t = 0; t < seconds; t += 0.01) {
+    car = step(car, delta, a, std::min(0.01, seconds - t), Integrator::RK4);
+  }
+}
+
+// Telemetry of one car as the simulator sends it, with six waypoints ahead.
+json record(const VehicleState<double>& car, double delta, double a) {
+  std::vector<double> ptsx, ptsy;
+  for (int k = 0; k < 6; k++) {
+    double x = car.x + 10 * k - 5;
+    ptsx.push_back(x);
+    ptsy.push_back(road(x));
+  }
+  json data;
+  data["ptsx"] = ptsx;
+  data["ptsy"] = ptsy;
+  data["x"] = car.x;
+  data["y"] = car.y;
+  data["psi"] = car.psi;
+  data["speed"] = car.v / 0.44704;
+  data["steering_angle"] = -delta;
+  data["throttle"] = a;
+  return data;
+}
+
+// The frame for the cars of a client, after the actuations of its cars
+// were delta[i] and a[i].
+std::string telemetry(const Client& c, bool fleet, const std::vector<double>& delta,
+                      const std::vector<double>& a) {
+  if (!fleet) {
+    return "42[\"telemetry\"," + record(c.cars[0], delta[0], a[0]).dump() + "]";
+  }
+  json vehicles = json::array();
+  for (size_t k = 0; k < c.cars.size(); k++) {
+    json data = record(c.cars[k], delta[k], a[k]);
+    data["id"] = k;
+    vehicles.push_back(data);
+  }
+  json data;
+  data["vehicles"] = vehicles;
+  return "42[\"fleet\"," + data.dump() + "]";
+}
+
+void send_all(int fd, const std::string& data) {
+  size_t sent = 0;
+  while (sent < data.size()) {
+    ssize_t n = send(fd, data.data() + sent, data.size() - sent, 0);
+    if (n <= 0) {
+      return;
+    }
+    sent += n;
+  }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  std::string host = "127.0.0.1";
+  int port = 4567;
+  size_t n_clients = 16;
+  double seconds = 10;
+  size_t fleet = 0;
+  bool real_time = false;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--host") && i + 1 < argc) {
+      host = argv[++i];
+    } else if (!strcmp(argv[i], "--port") && i + 1 < argc) {
+      port = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--connections") && i + 1 < argc) {
+      n_clients = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--seconds") && i + 1 < argc) {
+      seconds = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--fleet") && i + 1 < argc) {
+      fleet = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--real-time")) {
+      real_time = true;
+    } else {
+      std::cerr << "Usage: " << argv[0]
+                << " [--host a.b.c.d] [--port p] [--connections C] [--seconds s] [--fleet V]"
+                << " [--real-time]" << std::endl;
+      return -1;
+    }
+  }
+
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  inet_pton(AF_INET, host.c_str(), &address.sin_addr);
+
+  std::vector<Client> clients(n_clients);
+  std::vector<pollfd> fds(n_clients);
+  for (size_t i = 0; i < n_clients; i++) {
+    Client& c = clients[i];
+    for (size_t k = 0; k < std::max<size_t>(fleet, 1); k++) {
+      c.cars.push_back({20.0 * k, 1.5, 0, 10});
+    }
+    c.delta.assign(c.cars.size(), 0.0);
+    c.a.assign(c.cars.size(), 0.0);
+    c.fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(c.fd, (sockaddr*)&address, sizeof(address)) != 0) {
+      std::cerr << "Could not connect to " << host << ":" << port << std::endl;
+      return -1;
+    }
+    int one = 1;
+    setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    c.key = "bXBjLWxvYWQtY2xpZW50" + std::to_string(i) + "==";
+    send_all(c.fd, websocket_request(host, "/socket.io/?EIO=4&transport=websocket", c.key));
+    fds[i] = {c.fd, POLLIN, 0};
+  }
+
+  typedef std::chrono::steady_clock Clock;
+  LatencyHistogram round_trips;
+  size_t vehicles = 0;
+  size_t failures = 0;
+  double sum_cte = 0, max_cte = 0;
+  const Clock::time_point start = Clock::now();
+  const Clock::time_point end = start + std::chrono::duration_cast<Clock::duration>(
+                                            std::chrono::duration<double>(seconds));
+  while (Clock::now() < end) {
+    if (poll(fds.data(), fds.size(), 100) <= 0) {
+      continue;
+    }
+    for (size_t i = 0; i < n_clients; i++) {
+      if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+        continue;
+      }
+      Client& c = clients[i];
+      char buffer[65536];
+      ssize_t n = recv(c.fd, buffer, sizeof(buffer), 0);
+      if (n <= 0) {
+        std::cerr << "Connection " << i << " closed" << std::endl;
+        return -1;
+      }
+      c.input.append(buffer, n);
+
+      if (!c.upgraded) {
+        size_t size = http_request_size(c.input.data(), c.input.size());
+        if (size == 0) {
+          continue;
+        }
+        if (!websocket_accepted(c.input.substr(0, size), c.key)) {
+          std::cerr << "Handshake refused" << std::endl;
+          return -1;
+        }
+        c.input.erase(0, size);
+        c.upgraded = true;
+        c.sent = Clock::now();
+        send_all(c.fd, encode_frame(WebSocketOpcode::TEXT, telemetry(c, fleet, c.delta, c.a), true));
+        continue;
+      }
+
+      WebSocketFrame frame;
+      WebSocketError error;
+      size_t size;
+      while ((size = decode_frame(c.input.data(), c.input.size(), frame, false, error)) > 0) {
+        c.input.erase(0, size);
+        const std::string event = fleet ? "42[\"fleet_steer\"" : "42[\"steer\"";
+        if (frame.opcode != WebSocketOpcode::TEXT || frame.payload.compare(0, event.size(), event)) {
+          continue;
+        }
+        Clock::time_point now = Clock::now();
+        round_trips.record(std::chrono::duration<double, std::nano>(now - c.sent).count());
+
+        // Apply the actuations for a 100 ms frame, or from now on, and send
+        // the next one.
+        std::vector<double> delta(c.cars.size(), 0.0), a(c.cars.size(), 0.0);
+        try {
+          json reply = json::parse(frame.payload.substr(2))[1];
+          json records = fleet ? reply["vehicles"] : json::array({reply});
+          for (size_t k = 0; k < c.cars.size(); k++) {
+            delta[k] = -records.at(k).at("steering_angle").get<double>() * 0.436332;
+            a[k] = records.at(k).at("throttle");
+          }
+        } catch (...) {
+          failures++;
+        }
+        vehicles += c.cars.size();
+        const double elapsed = std::chrono::duration<double>(now - c.sent).count();
+        for (size_t k = 0; k < c.cars.size(); k++) {
+          if (real_time) {
+            drive(c.cars[k], c.delta[k], c.a[k], elapsed);
+          } else {
+            drive(c.cars[k], delta[k], a[k], 0.1);
+          }
+          const double cte = fabs(road(c.cars[k].x) - c.cars[k].y);
+          sum_cte += cte;
+          max_cte = std::max(max_cte, cte);
+        }
+        c.delta = delta;
+        c.a = a;
+        c.sent = now;
+        send_all(c.fd, encode_frame(WebSocketOpcode::TEXT, telemetry(c, fleet, c.delta, c.a), true));
+      }
+      if (error != WebSocketError::NONE) {
+        std::cerr << "Connection " << i << " sent an invalid frame" << std::endl;
+        return -1;
+      }
+    }
+  }
+
+  double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+  std::cout << n_clients << " connections, " << round_trips.count() << " replies in " << elapsed
+            << " s: " << round_trips.count() / elapsed << " per second";
+  if (fleet) {
+    std::cout << ", " << vehicles / elapsed << " vehicles per second";
+  }
+  if (failures > 0) {
+    std::cout << ", " << failures << " unreadable";
+  }
+  std::cout << std::endl;
+  if (vehicles > 0) {
+    std::cout << "cross track error  mean " << sum_cte / vehicles << " m  max " << max_cte << " m"
+              << std::endl;
+  }
+  round_trips.print(std::cout, "round trip");
+  for (Client& c : clients) {
+    close(c.fd);
+  }
+}
@@ -0,0 +1,29 @@
+#include "lqr.h"
+#include "Eigen-3.3/Eigen/Cholesky"
+
+Eigen::MatrixXd solve_dare(const Eigen::MatrixXd& A, const Eigen::MatrixXd& B,
+                           const Eigen::MatrixXd& Q, const Eigen::MatrixXd& R) {
+  const int max_iterations = 10000;
+  const double tolerance = 1e-10;
+
+  Eigen::MatrixXd P = Q;
+  for (int i = 0; i < max_iterations; i++) {
+    Eigen::MatrixXd K = lqr_gain(A, B, R, P);
+    Eigen::MatrixXd next = Q + A.transpose() * P * (A - B * K);
+    // Keep P symmetric against round-off.
+    next = (next + next.transpose()) / 2;
+
+    double change = (next - P).cwiseAbs().maxCoeff();
+    P = next;
+    if (change < tolerance * (1 + P.cwiseAbs().maxCoeff())) {
+      break;
+    }
+  }
+  return P;
+}
+
+Eigen::MatrixXd lqr_gain(const Eigen::MatrixXd& A, const Eigen::MatrixXd& B,
+                         const Eigen::MatrixXd& R, const Eigen::MatrixXd& P) {
+  Eigen::MatrixXd S = R + B.transpose() * P * B;
+  return S.ldlt().solve(B.transpose() * P * A);
+}
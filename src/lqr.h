@@ -0,0 +1,20 @@
+#ifndef LQR_H
+#define LQR_H
+
+#include "Eigen-3.3/Eigen/Core"
+
+// Solve the discrete-time algebraic Riccati equation
+//
+//   P = Q + A'PA - A'PB (R + B'PB)^-1 B'PA
+//
+// by fixed point iteration. x'Px is the infinite horizon cost-to-go of
+// x[t+1] = A x[t] + B u[t] with stage cost x'Qx + u'Ru under the optimal
+// feedback u = -Kx.
+Eigen::MatrixXd solve_dare(const Eigen::MatrixXd& A, const Eigen::MatrixXd& B,
+                           const Eigen::MatrixXd& Q, const Eigen::MatrixXd& R);
+
+// The optimal feedback gain K = (R + B'PB)^-1 B'PA for a solution P.
+Eigen::MatrixXd lqr_gain(const Eigen::MatrixXd& A, const Eigen::MatrixXd& B,
+                         const Eigen::MatrixXd& R, const Eigen::MatrixXd& P);
+
+#endif /* LQR_H */
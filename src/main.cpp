@@ -1,233 +1,131 @@
-#include <math.h>
+#include <poll.h>
 #include <uWS/uWS.h>
+#include <uv.h>
 #include <chrono>
+#include <cstring>
 #include <iostream>
 #include <thread>
 #include <vector>
-#include "Eigen-3.3/Eigen/Core"
-#include "Eigen-3.3/Eigen/QR"
 #include "MPC.h"
-#include "json.hpp"
-
-// for convenience
-using json = nlohmann::json;
-
-// For converting back and forth between radians and degrees.
-constexpr double pi() { return M_PI; }
-double deg2rad(double x) { return x * pi() / 180; }
-double rad2deg(double x) { return x * 180 / pi(); }
-
-// Checks if the SocketIO event has JSON data.
-// If there is data the JSON object in string format will be returned,
-// else the empty string "" will be returned.
-string hasData(string s) {
-  auto found_null = s.find("null");
-  auto b1 = s.find_first_of("[");
-  auto b2 = s.rfind("}]");
-  if (found_null != string::npos) {
-    return "";
-  } else if (b1 != string::npos && b2 != string::npos) {
-    return s.substr(b1, b2 - b1 + 2);
-  }
-  return "";
-}
-
-// Evaluate a polynomial.
-double polyeval(Eigen::VectorXd coeffs, double x) {
-  double result = 0.0;
-  for (int i = 0; i < coeffs.size(); i++) {
-    result += coeffs[i] * pow(x, i);
-  }
-  return result;
+#include "busy_poll.h"
+#include "fleet.h"
+#include "pool.h"
+#include "profiler.h"
+#include "structure.h"
+#include "telemetry.h"
+
+// h.run() for busy-poll mode, see busy_poll.h. The loop's epoll
+// descriptor is readable whenever one of its sockets is, and h.poll()
+// handles whatever is ready without blocking. Timers do not show up on the
+// descriptor, so the spin also stops for the loop whenever its backend
+// timeout says one is due.
+void run_busy_poll(uWS::Hub &h, const BusyPollConfig &busy_poll) {
+  uv_loop_t *loop = h.getLoop();
+  struct pollfd backend = {uv_backend_fd(loop), POLLIN, 0};
+  spin_then_block(busy_poll.spin_us,
+                  [&](int timeout_ms) {
+                    if (timeout_ms == 0) {
+                      // The loop's clock only moves in uv_run().
+                      uv_update_time(loop);
+                      return ::poll(&backend, 1, 0) > 0 || uv_backend_timeout(loop) == 0;
+                    }
+                    // Sleep until a socket is ready or the next timer is
+                    // due, then let the loop sort out which.
+                    ::poll(&backend, 1, uv_backend_timeout(loop));
+                    return true;
+                  },
+                  [&] {
+                    h.poll();
+                    return true;
+                  });
 }
 
-// Fit a polynomial.
-// Adapted from
-// https://github.com/JuliaMath/Polynomials.jl/blob/master/src/Polynomials.jl#L676-L716
-Eigen::VectorXd polyfit(Eigen::VectorXd xvals, Eigen::VectorXd yvals,
-                        int order) {
-  assert(xvals.size() == yvals.size());
-  assert(order >= 1 && order <= xvals.size() - 1);
-  Eigen::MatrixXd A(xvals.size(), order + 1);
-
-  for (int i = 0; i < xvals.size(); i++) {
-    A(i, 0) = 1.0;
-  }
+int main(int argc, char *argv[]) {
+  uWS::Hub h;
 
-  for (int j = 0; j < xvals.size(); j++) {
-    for (int i = 0; i < order; i++) {
-      A(j, i + 1) = A(j, i) * xvals(j);
+  // --busy-poll [--spin-us us] dedicates a core to the event loop.
+  // --latency-ms holds every steering reply back by that much instead of
+  // the simulated actuation latency, e.g. 0 for load tests.
+  // --solver picks the solver, and --threads how many threads solve the
+  // vehicles of a fleet frame (see fleet.h; Ipopt solves them one by one).
+  // --profile-hz samples the process and serves the profile at /profile
+  // (see profiler.h).
+  // --controllers is the number of vehicles that can be driven at once
+  // (see pool.h).
+  // --linearisation-table has RTI look its Jacobians up in a table, and
+  // --structure-cache keeps that table in a directory for the next start
+  // (see structure_cache.h).
+  BusyPollConfig busy_poll;
+  int latency_ms = static_cast<int>(actuation_latency * 1000);
+  MPCConfig config;
+  // Solves run on the worker threads, which would interleave the cost
+  // lines.
+  config.verbose = false;
+  size_t threads = 0;
+  double profile_hz = 0;
+  std::string structure_cache;
+  size_t controllers = 256;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--busy-poll")) {
+      busy_poll.enabled = true;
+    } else if (!strcmp(argv[i], "--spin-us") && i + 1 < argc) {
+      busy_poll.spin_us = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--latency-ms") && i + 1 < argc) {
+      latency_ms = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--solver") && i + 1 < argc && parse_solver(argv[i + 1], config.solver)) {
+      i++;
+    } else if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+      threads = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--profile-hz") && i + 1 < argc) {
+      profile_hz = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--linearisation-table")) {
+      config.linearisation_table = true;
+    } else if (!strcmp(argv[i], "--structure-cache") && i + 1 < argc) {
+      structure_cache = argv[++i];
+    } else if (!strcmp(argv[i], "--controllers") && i + 1 < argc) {
+      controllers = atoi(argv[++i]);
+    } else {
+      std::cerr << "Usage: " << argv[0] << " [--busy-poll] [--spin-us us] [--latency-ms ms]"
+                << " [--solver ipopt|rti|lm] [--threads n] [--profile-hz hz]"
+                << " [--controllers n] [--linearisation-table] [--structure-cache dir]"
+                << std::endl;
+      return -1;
     }
   }
 
-  auto Q = A.householderQr();
-  auto result = Q.solve(yvals);
-  return result;
-}
-
-vector<double> global2car(double psi, double px, double py, double x_global, double y_global)
-{
-    double dx = x_global - px;
-    double dy = y_global - py;
-    double sin_psi = sin(psi);
-    double cos_psi = cos(psi);
-
-    double x_car = dx*cos_psi + dy*sin_psi;
-    double y_car = - dx*sin_psi + dy*cos_psi;
-
-    return {x_car, y_car};
-}
-
-
-int main() {
-  uWS::Hub h;
-
-  // MPC is initialized here!
-  MPC mpc;
-
-  h.onMessage([&mpc](uWS::WebSocket<uWS::SERVER> ws, char *data, size_t length,
-                     uWS::OpCode opCode) {
-    // "42" at the start of the message means there's a websocket message event.
-    // The 4 signifies a websocket message
-    // The 2 signifies a websocket event
-    string sdata = string(data).substr(0, length);
+  // The problem structure is built here, once, and shared by the
+  // controller of every connection. With --structure-cache its slow parts
+  // are cached there for the next start.
+  auto structure = ProblemStructure::get(config, structure_cache);
+  // Controllers ready for the connections to come.
+  ControllerPool pool(structure, controllers);
+  WorkerThreads workers(threads);
+
+  h.onMessage([&config, &latency_ms, &workers](uWS::WebSocket<uWS::SERVER> ws, char *data,
+                                               size_t length, uWS::OpCode opCode) {
+    // This connection's controllers, see onConnection.
+    Fleet *fleet = static_cast<Fleet *>(ws.getUserData());
+    if (!fleet) {
+      return;
+    }
+    string sdata = string(data, length);
     cout << sdata << endl;
-    if (sdata.size() > 2 && sdata[0] == '4' && sdata[1] == '2') {
-      string s = hasData(sdata);
-      if (s != "") {
-        auto j = json::parse(s);
-        string event = j[0].get<string>();
-        if (event == "telemetry") {
-          // j[1] is the data JSON object
-          vector<double> ptsx = j[1]["ptsx"];
-          vector<double> ptsy = j[1]["ptsy"];
-          double px = j[1]["x"];
-          double py = j[1]["y"];
-          double psi = j[1]["psi"];
-          double v = j[1]["speed"];
-          double delta = j[1]["steering_angle"];
-          double acceleration = j[1]["throttle"];
-
-          v = v * 0.44704; // convert to m/s from mph
-          delta = -delta; // convert steering angle delta sign from simulator
-
-          // predict state in 100ms using kinematic model
-          double latency = 0.1;
-          double Lf = 2.67;
-          px = px + v*cos(psi)*latency;     // x_[t+1] = x[t] + v[t] * cos(psi[t]) * dt
-          py = py + v*sin(psi)*latency;     // y_[t+1] = y[t] + v[t] * sin(psi[t]) * dt
-          psi = psi + v*delta/Lf*latency;   // psi_[t+1] = psi[t] + v[t] / Lf * delta[t] * dt
-          v = v + acceleration*latency;     // v_[t+1] = v[t] + a[t] * dt
-
-          Eigen::VectorXd way_pts_x(ptsx.size());
-          Eigen::VectorXd way_pts_y(ptsx.size());
-
-          // Tranform waypoints to car co-ordinates. 
-          // Remainder of the calculations are done in car co-ordinate system
-          for(size_t i=0; i < ptsx.size(); i++) {
-            auto coord_car = global2car(psi, px, py, ptsx[i], ptsy[i]);
-            way_pts_x(i) = coord_car[0];
-            way_pts_y(i) = coord_car[1];
-          }
-
-          // Fit a third order polynomial to way points to
-          // model the reference trajectory
-          auto coeffs = polyfit(way_pts_x, way_pts_y, 3);
-
-          // Since we are in the car co-ordinate system the cross track error
-          // is simply the y co-ordinate of the reference trajectory at x = 0
-          double cte = polyeval(coeffs,0);
-          // For the same reason error in yaw angle is the direction of the
-          // reference trajectory at x = 0. i.e. arctangent of the derivative
-          // of the reference trajectory
-          double epsi = -atan(coeffs[1]);
-
-
-          /*
-          State variables 
-             x and y positions of car
-             yaw angle
-             speed in heading direction
-             cross track error
-             yaw angle error
-
-          Since we are in car-cordinate system the cars position (x,y) and yaw angle (psi) are all 0.
-          Since car-cordinate system has the same scale as the global system v does not change
-          */
-          Eigen::VectorXd state(6);
-          state << 0, 0, 0, v, cte, epsi;
-
-          /*
-          * Calculate steering angle and throttle using MPC.
-          * Both are in between [-1, 1].
-          *
-          */
-          auto result = mpc.Solve(state, coeffs);
-
-          // Apply the first actuation values from the solver to the car
-          double steer_value = -result[0];
-          double throttle_value = result[1];
-
-          json msgJson;
-          // NOTE: Remember to divide by deg2rad(25) before you send the steering value back.
-          // Otherwise the values will be in between [-deg2rad(25), deg2rad(25] instead of [-1, 1].
-          msgJson["steering_angle"] = steer_value/deg2rad(25);
-          msgJson["throttle"] = throttle_value;
-
-          //Display the MPC predicted trajectory 
-          vector<double> mpc_x_vals;
-          vector<double> mpc_y_vals;
-
-          //.. add (x,y) points to list here, points are in reference to the vehicle's coordinate system
-          // the points in the simulator are connected by a Green line
-          size_t n = (result.size()-2)/2;
-          for (size_t i = 0; i < n; i ++) {
-              mpc_x_vals.push_back(result[i + 2]);
-              mpc_y_vals.push_back(result[i + n + 2]);
-          }
-
-          msgJson["mpc_x"] = mpc_x_vals;
-          msgJson["mpc_y"] = mpc_y_vals;
-
-          //Display the waypoints/reference line
-          vector<double> next_x_vals;
-          vector<double> next_y_vals;
-
-          //.. add (x,y) points to list here, points are in reference to the vehicle's coordinate system
-          // the points in the simulator are connected by a Yellow line
-          for (int i = 0; i < way_pts_x.size(); i += 1){
-            //next_x_vals.push_back(way_pts_x(i));
-            //next_y_vals.push_back(way_pts_y(i));
-          }
-
-          for (double i = 0; i < 100.0; i += 2){
-            next_x_vals.push_back(i);
-            next_y_vals.push_back(polyeval(coeffs, i));
-          }
-
-          msgJson["next_x"] = next_x_vals;
-          msgJson["next_y"] = next_y_vals;
-
-
-          auto msg = "42[\"steer\"," + msgJson.dump() + "]";
-          std::cout << msg << std::endl;
-          // Latency
-          // The purpose is to mimic real driving conditions where
-          // the car does actuate the commands instantly.
-          //
-          // Feel free to play around with this value but should be to drive
-          // around the track with 100ms latency.
-          //
-          // NOTE: REMEMBER TO SET THIS TO 100 MILLISECONDS BEFORE
-          // SUBMITTING.
-          this_thread::sleep_for(chrono::milliseconds(static_cast<int>(latency*1000)));
-          ws.send(msg.data(), msg.length(), uWS::OpCode::TEXT);
-        }
-      } else {
-        // Manual driving
-        std::string msg = "42[\"manual\",{}]";
-        ws.send(msg.data(), msg.length(), uWS::OpCode::TEXT);
-      }
+    TelemetryReply reply = handle_message(sdata, *fleet, config, workers);
+    if (reply.delayed) {
+      std::cout << reply.message << std::endl;
+      // Latency
+      // The purpose is to mimic real driving conditions where
+      // the car does actuate the commands instantly.
+      //
+      // Feel free to play around with this value but should be to drive
+      // around the track with 100ms latency.
+      //
+      // NOTE: REMEMBER TO SET THIS TO 100 MILLISECONDS BEFORE
+      // SUBMITTING.
+      this_thread::sleep_for(chrono::milliseconds(latency_ms));
+    }
+    if (!reply.message.empty()) {
+      ws.send(reply.message.data(), reply.message.length(), uWS::OpCode::TEXT);
     }
   });
 
@@ -239,22 +137,46 @@ int main() {
     const std::string s = "<h1>Hello world!</h1>";
     if (req.getUrl().valueLength == 1) {
       res->end(s.data(), s.length());
+    } else if (req.getUrl().toString() == "/profile") {
+      const std::string profile = folded_profile();
+      res->end(profile.data(), profile.length());
     } else {
       // i guess this should be done more gracefully?
       res->end(nullptr, 0);
     }
   });
 
-  h.onConnection([&h](uWS::WebSocket<uWS::SERVER> ws, uWS::HttpRequest req) {
+  // One controller per vehicle: each keeps its own previous solution, all
+  // of them share the structure. They come from the pool and go back to it,
+  // through the connection's fleet.
+  h.onConnection([&h, &pool, &busy_poll](uWS::WebSocket<uWS::SERVER> ws, uWS::HttpRequest req) {
+    Fleet *fleet = pool.connect();
+    if (!fleet) {
+      // 1013: try again later.
+      std::cerr << "No controller free, closing the connection" << std::endl;
+      ws.close(1013);
+      return;
+    }
+    ws.setUserData(fleet);
+    if (busy_poll.enabled && busy_poll.socket_busy_poll_us > 0 &&
+        !set_socket_busy_poll(ws.getFd(), busy_poll.socket_busy_poll_us)) {
+      std::cerr << "SO_BUSY_POLL not permitted, spinning in user space only" << std::endl;
+    }
     std::cout << "Connected!!!" << std::endl;
   });
 
-  h.onDisconnection([&h](uWS::WebSocket<uWS::SERVER> ws, int code,
-                         char *message, size_t length) {
+  h.onDisconnection([&h, &pool](uWS::WebSocket<uWS::SERVER> ws, int code,
+                                char *message, size_t length) {
+    pool.disconnect(static_cast<Fleet *>(ws.getUserData()));
+    ws.setUserData(nullptr);
     ws.close();
     std::cout << "Disconnected" << std::endl;
   });
 
+  if (profile_hz > 0 && !start_profiler(profile_hz)) {
+    std::cerr << "Could not start the profiler" << std::endl;
+  }
+
   int port = 4567;
   if (h.listen(port)) {
     std::cout << "Listening to port " << port << std::endl;
@@ -262,5 +184,9 @@ int main() {
     std::cerr << "Failed to listen to port" << std::endl;
     return -1;
   }
-  h.run();
+  if (busy_poll.enabled) {
+    run_busy_poll(h, busy_poll);
+  } else {
+    h.run();
+  }
 }
@@ -0,0 +1,133 @@
+#ifndef MODEL_H
+#define MODEL_H
+
+#include <cmath>
+#include <vector>
+#include "fastmath.h"
+
+/*
+ Kinematic bicycle model shared by the solver, the latency predictor and
+ the rollouts.
+
+ Every function is a template on the scalar type so the same code is taped
+ by CppAD inside FG_eval (AD<double>), differentiated by the
+ linearisation, evaluated directly elsewhere (double) and evaluated for
+ several vehicles at once (Pack, see batch.h). double and Pack take their
+ sines and cosines from the vectorised kernels of fastmath.h.
+ */
+
+// This value assumes the model presented in the classroom is used.
+//
+// This is the length from front to CoG that has a similar radius.
+const double Lf = 2.67;
+
+// How the model is integrated over one timestep.
+enum class Integrator {
+  // x_[t+1] = x[t] + v[t] * cos(psi[t]) * dt, ...
+  // Error grows quickly with dt.
+  EULER,
+  // Classic 4th order Runge-Kutta with delta and a held over the step.
+  RK4,
+  // Closed form for a constant steering angle: the car moves along a
+  // circular arc of radius Lf / delta. The heading is linear in the
+  // distance travelled, so this is exact for any a.
+  CONSTANT_TURN_RATE
+};
+
+// s = sin(x), c = cos(x): the scalar type's own, e.g. CppAD's while
+// taping, or the fastmath.h kernels for double and Pack.
+template <typename T>
+void model_sincos(const T& x, T& s, T& c) {
+  using std::cos;
+  using std::sin;
+  s = sin(x);
+  c = cos(x);
+}
+inline void model_sincos(const double& x, double& s, double& c) { fast_sincos(x, s, c); }
+inline void model_sincos(const Pack& x, Pack& s, Pack& c) { sincos_pack(x, s, c); }
+
+template <typename T>
+struct VehicleState {
+  T x;
+  T y;
+  T psi;
+  T v;
+};
+
+// Time derivative of the state with the actuations held constant.
+template <typename T>
+VehicleState<T> derivative(const VehicleState<T>& s, const T& delta, const T& a) {
+  T sin_psi, cos_psi;
+  model_sincos(s.psi, sin_psi, cos_psi);
+  return {s.v * cos_psi, s.v * sin_psi, s.v * delta / Lf, a};
+}
+
+// sin(h) / h as a Taylor series, so there is no branch at h = 0 for CppAD
+// to record. The truncation error is below 1e-9 for |h| < 2, i.e. a turn of
+// 4 radians in one step.
+template <typename T>
+T sinc(const T& h) {
+  T h2 = h * h;
+  return 1.0 + h2 * (-1.0 / 6 + h2 * (1.0 / 120 + h2 * (-1.0 / 5040 +
+         h2 * (1.0 / 362880 + h2 * (-1.0 / 39916800 +
+         h2 * (1.0 / 6227020800 + h2 * (-1.0 / 1307674368000)))))));
+}
+
+// Advance the state by dt with delta and a held constant.
+template <typename T>
+VehicleState<T> step(const VehicleState<T>& s, const T& delta, const T& a,
+                     double dt, Integrator integrator) {
+  switch (integrator) {
+    case Integrator::RK4: {
+      VehicleState<T> k1 = derivative(s, delta, a);
+      VehicleState<T> s2 = {s.x + k1.x * (dt / 2), s.y + k1.y * (dt / 2),
+                            s.psi + k1.psi * (dt / 2), s.v + k1.v * (dt / 2)};
+      VehicleState<T> k2 = derivative(s2, delta, a);
+      VehicleState<T> s3 = {s.x + k2.x * (dt / 2), s.y + k2.y * (dt / 2),
+                            s.psi + k2.psi * (dt / 2), s.v + k2.v * (dt / 2)};
+      VehicleState<T> k3 = derivative(s3, delta, a);
+      VehicleState<T> s4 = {s.x + k3.x * dt, s.y + k3.y * dt,
+                            s.psi + k3.psi * dt, s.v + k3.v * dt};
+      VehicleState<T> k4 = derivative(s4, delta, a);
+      return {s.x + (k1.x + 2 * k2.x + 2 * k3.x + k4.x) * (dt / 6),
+              s.y + (k1.y + 2 * k2.y + 2 * k3.y + k4.y) * (dt / 6),
+              s.psi + (k1.psi + 2 * k2.psi + 2 * k3.psi + k4.psi) * (dt / 6),
+              s.v + (k1.v + 2 * k2.v + 2 * k3.v + k4.v) * (dt / 6)};
+    }
+    case Integrator::CONSTANT_TURN_RATE: {
+      // The distance travelled is v_mid * dt because v changes linearly over
+      // the step. The position follows the chord of the arc: length
+      // v_mid * dt * sinc(h) at the mean heading psi + h, where h is half
+      // the turn.
+      T v_mid = s.v + a * (dt / 2);
+      T h = v_mid * delta / Lf * (dt / 2);
+      T chord = v_mid * dt * sinc(h);
+      T sin_heading, cos_heading;
+      model_sincos(T(s.psi + h), sin_heading, cos_heading);
+      return {s.x + chord * cos_heading, s.y + chord * sin_heading,
+              s.psi + 2 * h, s.v + a * dt};
+    }
+    case Integrator::EULER:
+    default: {
+      VehicleState<T> d = derivative(s, delta, a);
+      return {s.x + d.x * dt, s.y + d.y * dt, s.psi + d.psi * dt,
+              s.v + d.v * dt};
+    }
+  }
+}
+
+// Apply the actuations in turn, one timestep each, and return every state
+// visited including the initial one.
+template <typename T>
+std::vector<VehicleState<T>> rollout(const VehicleState<T>& initial,
+                                     const std::vector<T>& deltas,
+                                     const std::vector<T>& as, double dt,
+                                     Integrator integrator) {
+  std::vector<VehicleState<T>> states(1, initial);
+  for (size_t t = 0; t < deltas.size(); t++) {
+    states.push_back(step(states.back(), deltas[t], as[t], dt, integrator));
+  }
+  return states;
+}
+
+#endif /* MODEL_H */
@@ -0,0 +1,374 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include "busy_poll.h"
+
+/*
+ TCP proxy that impairs the network between a client (the simulator or
+ mpc_load) and a server, for latency and jitter testing on one machine.
+
+ Every chunk of bytes read from one side is held back before it is
+ written to the other:
+
+ - a one-way delay, constant or drawn from a uniform, normal or Pareto
+   (heavy-tailed) distribution around --delay-ms with spread --jitter-ms;
+ - bursts: with --burst-probability a chunk stalls the link for
+   --burst-ms, and whatever arrives meanwhile comes out at once when it
+   ends;
+ - a bandwidth limit: with --rate-kbps each chunk also waits for the ones
+   before it to go through a link of that rate.
+
+ The byte stream stays in order as over TCP, so a chunk is never written
+ before the one ahead of it: a late chunk holds back those behind it, and
+ frames sent apart can arrive together. The added delays are printed on
+ exit (Ctrl-C).
+
+ E.g. 30 ms +- 10 ms each way in front of the server:
+
+   ./mpc_uring --solver rti &
+   ./mpc_netem --listen 4568 --upstream 127.0.0.1:4567 --delay-ms 30 --jitter-ms 10 &
+   ./mpc_load --port 4568 --real-time
+
+ Usage: mpc_netem [--listen p] [--upstream a.b.c.d:p] [--delay-ms ms]
+                  [--jitter-ms ms] [--distribution uniform|normal|pareto]
+                  [--burst-probability p] [--burst-ms ms] [--rate-kbps r]
+                  [--direction both|up|down] [--seed s]
+ */
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+enum class Distribution { UNIFORM, NORMAL, PARETO };
+
+struct Impairment {
+  double delay_ms = 0;
+  double jitter_ms = 0;
+  Distribution distribution = Distribution::NORMAL;
+  double burst_probability = 0;
+  double burst_ms = 0;
+  // 0 for no limit.
+  double rate_kbps = 0;
+};
+
+// Reading stops while this much is held back in one direction.
+const size_t max_queued = 4 << 20;
+
+Clock::duration milliseconds(double ms) {
+  return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(ms));
+}
+
+// One direction of a proxied connection.
+struct Direction {
+  int from = -1;
+  int to = -1;
+  // Null to pass the bytes through as they come.
+  const Impairment* impairment = nullptr;
+  std::mt19937 gen;
+
+  struct Chunk {
+    Clock::time_point due;
+    std::string data;
+  };
+  std::deque<Chunk> queue;
+  size_t queued = 0;
+  // from has closed; to is shut down once the queue is written.
+  bool eof = false;
+  bool shut = false;
+  // The last write would have blocked.
+  bool blocked = false;
+
+  Clock::time_point last_due;
+  Clock::time_point link_free;
+  Clock::time_point stall_until;
+
+  // Added delay of every chunk.
+  LatencyHistogram* delays = nullptr;
+
+  // The one-way delay of the next chunk, at least 0.
+  double sample_delay_ms() {
+    const Impairment& m = *impairment;
+    double ms = m.delay_ms;
+    if (m.jitter_ms > 0) {
+      switch (m.distribution) {
+        case Distribution::UNIFORM:
+          ms += std::uniform_real_distribution<double>(-m.jitter_ms, m.jitter_ms)(gen);
+          break;
+        case Distribution::NORMAL:
+          ms += std::normal_distribution<double>(0, m.jitter_ms)(gen);
+          break;
+        case Distribution::PARETO: {
+          // Excess over the delay with shape 3 and mean jitter_ms.
+          const double u = std::uniform_real_distribution<double>(0, 1)(gen);
+          ms += 2 * m.jitter_ms * (std::pow(1 - u, -1.0 / 3) - 1);
+          break;
+        }
+      }
+    }
+    return std::max(ms, 0.0);
+  }
+
+  void push(const char* data, size_t size, Clock::time_point now) {
+    Clock::time_point due = now;
+    if (impairment) {
+      const Impairment& m = *impairment;
+      if (m.rate_kbps > 0) {
+        link_free = std::max(link_free, now) + milliseconds(size * 8 / m.rate_kbps);
+        due = link_free;
+      }
+      if (m.burst_probability > 0 &&
+          std::uniform_real_distribution<double>(0, 1)(gen) < m.burst_probability) {
+        stall_until = std::max(stall_until, now + milliseconds(m.burst_ms));
+      }
+      due = std::max(due + milliseconds(sample_delay_ms()), stall_until);
+    }
+    // In order, as the stream is.
+    due = std::max(due, last_due);
+    last_due = due;
+    delays->record(std::chrono::duration<double, std::nano>(due - now).count());
+    queue.push_back(Chunk{due, std::string(data, size)});
+    queued += size;
+  }
+
+  // Write what is due. False if the connection failed.
+  bool flush(Clock::time_point now) {
+    blocked = false;
+    while (!queue.empty() && queue.front().due <= now) {
+      std::string& data = queue.front().data;
+      ssize_t n = send(to, data.data(), data.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+      if (n < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+          blocked = true;
+          return true;
+        }
+        return false;
+      }
+      queued -= n;
+      if (static_cast<size_t>(n) < data.size()) {
+        data.erase(0, n);
+        blocked = true;
+        return true;
+      }
+      queue.pop_front();
+    }
+    if (eof && queue.empty() && !shut) {
+      shutdown(to, SHUT_WR);
+      shut = true;
+    }
+    return true;
+  }
+};
+
+struct Session {
+  // Client to server, and back.
+  Direction up;
+  Direction down;
+  bool failed = false;
+
+  bool done() const { return failed || (up.shut && down.shut); }
+};
+
+volatile sig_atomic_t stop = 0;
+
+void on_signal(int) { stop = 1; }
+
+bool parse_distribution(const std::string& name, Distribution& distribution) {
+  if (name == "uniform") {
+    distribution = Distribution::UNIFORM;
+  } else if (name == "normal") {
+    distribution = Distribution::NORMAL;
+  } else if (name == "pareto") {
+    distribution = Distribution::PARETO;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  int listen_port = 4568;
+  std::string upstream_host = "127.0.0.1";
+  int upstream_port = 4567;
+  Impairment impairment;
+  bool impair_up = true, impair_down = true;
+  unsigned seed = 1;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--listen") && i + 1 < argc) {
+      listen_port = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--upstream") && i + 1 < argc &&
+               strchr(argv[i + 1], ':')) {
+      std::string upstream = argv[++i];
+      upstream_host = upstream.substr(0, upstream.rfind(':'));
+      upstream_port = atoi(upstream.substr(upstream.rfind(':') + 1).c_str());
+    } else if (!strcmp(argv[i], "--delay-ms") && i + 1 < argc) {
+      impairment.delay_ms = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--jitter-ms") && i + 1 < argc) {
+      impairment.jitter_ms = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--distribution") && i + 1 < argc &&
+               parse_distribution(argv[i + 1], impairment.distribution)) {
+      i++;
+    } else if (!strcmp(argv[i], "--burst-probability") && i + 1 < argc) {
+      impairment.burst_probability = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--burst-ms") && i + 1 < argc) {
+      impairment.burst_ms = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--rate-kbps") && i + 1 < argc) {
+      impairment.rate_kbps = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--direction") && i + 1 < argc &&
+               (!strcmp(argv[i + 1], "both") || !strcmp(argv[i + 1], "up") ||
+                !strcmp(argv[i + 1], "down"))) {
+      std::string direction = argv[++i];
+      impair_up = direction != "down";
+      impair_down = direction != "up";
+    } else if (!strcmp(argv[i], "--seed") && i + 1 < argc) {
+      seed = atoi(argv[++i]);
+    } else {
+      std::cerr << "Usage: " << argv[0]
+                << " [--listen p] [--upstream a.b.c.d:p] [--delay-ms ms] [--jitter-ms ms]"
+                << " [--distribution uniform|normal|pareto] [--burst-probability p]"
+                << " [--burst-ms ms] [--rate-kbps r] [--direction both|up|down] [--seed s]"
+                << std::endl;
+      return -1;
+    }
+  }
+
+  sockaddr_in upstream = {};
+  upstream.sin_family = AF_INET;
+  upstream.sin_port = htons(upstream_port);
+  inet_pton(AF_INET, upstream_host.c_str(), &upstream.sin_addr);
+
+  int listener = socket(AF_INET, SOCK_STREAM, 0);
+  int one = 1;
+  setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  address.sin_port = htons(listen_port);
+  if (listener < 0 || bind(listener, (sockaddr*)&address, sizeof(address)) != 0 ||
+      listen(listener, 512) != 0) {
+    std::cerr << "Failed to listen to port " << listen_port << std::endl;
+    return -1;
+  }
+  std::cout << "Listening to port " << listen_port << ", forwarding to " << upstream_host << ":"
+            << upstream_port << std::endl;
+
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+
+  LatencyHistogram up_delays, down_delays;
+  std::vector<std::unique_ptr<Session>> sessions;
+  unsigned n_sessions = 0;
+  while (!stop) {
+    // Write whatever is due, and sleep until the next chunk is.
+    Clock::time_point now = Clock::now();
+    Clock::time_point wake = now + std::chrono::seconds(1);
+    for (auto& s : sessions) {
+      for (Direction* d : {&s->up, &s->down}) {
+        if (!d->flush(now)) {
+          s->failed = true;
+        } else if (!d->queue.empty() && !d->blocked) {
+          wake = std::min(wake, d->queue.front().due);
+        }
+      }
+    }
+    sessions.erase(std::remove_if(sessions.begin(), sessions.end(),
+                                  [](const std::unique_ptr<Session>& s) {
+                                    if (s->done()) {
+                                      close(s->up.from);
+                                      close(s->up.to);
+                                    }
+                                    return s->done();
+                                  }),
+                   sessions.end());
+
+    std::vector<pollfd> fds = {{listener, POLLIN, 0}};
+    for (auto& s : sessions) {
+      // Each socket reads for one direction and writes for the other.
+      for (Direction* d : {&s->up, &s->down}) {
+        Direction* back = d == &s->up ? &s->down : &s->up;
+        short events = 0;
+        if (!d->eof && d->queued < max_queued) {
+          events |= POLLIN;
+        }
+        if (back->blocked) {
+          events |= POLLOUT;
+        }
+        fds.push_back({d->from, events, 0});
+      }
+    }
+    const int timeout_ms = static_cast<int>(std::ceil(
+        std::chrono::duration<double, std::milli>(wake - now).count()));
+    if (poll(fds.data(), fds.size(), std::max(timeout_ms, 0)) < 0) {
+      continue;
+    }
+
+    now = Clock::now();
+    if (fds[0].revents & POLLIN) {
+      int client = accept(listener, nullptr, nullptr);
+      int server = socket(AF_INET, SOCK_STREAM, 0);
+      if (client >= 0 && connect(server, (sockaddr*)&upstream, sizeof(upstream)) == 0) {
+        std::unique_ptr<Session> s(new Session);
+        setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        setsockopt(server, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        s->up.from = s->down.to = client;
+        s->up.to = s->down.from = server;
+        s->up.impairment = impair_up ? &impairment : nullptr;
+        s->down.impairment = impair_down ? &impairment : nullptr;
+        s->up.gen.seed(seed + 2 * n_sessions);
+        s->down.gen.seed(seed + 2 * n_sessions + 1);
+        s->up.delays = &up_delays;
+        s->down.delays = &down_delays;
+        s->up.last_due = s->up.link_free = s->up.stall_until = now;
+        s->down.last_due = s->down.link_free = s->down.stall_until = now;
+        sessions.push_back(std::move(s));
+        n_sessions++;
+      } else {
+        std::cerr << "Could not connect to " << upstream_host << ":" << upstream_port << std::endl;
+        close(client);
+        close(server);
+      }
+    }
+    for (size_t k = 1; k < fds.size(); k++) {
+      Session& s = *sessions[(k - 1) / 2];
+      Direction& d = (k - 1) % 2 == 0 ? s.up : s.down;
+      if (!(fds[k].revents & (POLLIN | POLLHUP | POLLERR)) || d.eof) {
+        continue;
+      }
+      char buffer[65536];
+      ssize_t n = recv(d.from, buffer, sizeof(buffer), MSG_DONTWAIT);
+      if (n > 0) {
+        d.push(buffer, n, now);
+      } else if (n == 0) {
+        d.eof = true;
+      } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        s.failed = true;
+      }
+    }
+  }
+
+  for (auto& s : sessions) {
+    close(s->up.from);
+    close(s->up.to);
+  }
+  close(listener);
+  std::cout << n_sessions << " connections" << std::endl;
+  up_delays.print(std::cout, "added delay, client to server");
+  down_delays.print(std::cout, "added delay, server to client");
+}
@@ -0,0 +1,80 @@
+#include "pool.h"
+#include "fleet.h"
+
+ControllerPool::ControllerPool(std::shared_ptr<const ProblemStructure> structure,
+                               size_t capacity)
+    : structure(structure), nominal(structure) {
+  if (structure->config.solver != Solver::IPOPT) {
+    // Straight ahead at the reference speed on a straight road.
+    Eigen::VectorXd state(n_states);
+    state << 0, 0, 0, ref_v, 0, 0;
+    nominal.Solve(state, Eigen::VectorXd::Zero(4));
+  }
+
+  contexts.reserve(capacity);
+  available.reserve(capacity);
+  for (size_t i = 0; i < capacity; i++) {
+    contexts.emplace_back(new MPC(structure));
+    contexts.back()->Seed(nominal);
+    available.push_back(contexts.back().get());
+  }
+
+  connections.reserve(capacity);
+  idle.reserve(capacity);
+  for (size_t i = 0; i < capacity; i++) {
+    connections.emplace_back(new Fleet(*this));
+    idle.push_back(connections.back().get());
+  }
+}
+
+ControllerPool::~ControllerPool() {}
+
+Fleet* ControllerPool::connect() {
+  Fleet* fleet;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (idle.empty()) {
+      return nullptr;
+    }
+    fleet = idle.back();
+    idle.pop_back();
+  }
+  if (!fleet->attach()) {
+    std::lock_guard<std::mutex> lock(mutex);
+    idle.push_back(fleet);
+    return nullptr;
+  }
+  return fleet;
+}
+
+void ControllerPool::disconnect(Fleet* fleet) {
+  if (fleet) {
+    fleet->detach();
+    std::lock_guard<std::mutex> lock(mutex);
+    idle.push_back(fleet);
+  }
+}
+
+MPC* ControllerPool::acquire() {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (available.empty()) {
+    return nullptr;
+  }
+  MPC* controller = available.back();
+  available.pop_back();
+  return controller;
+}
+
+void ControllerPool::release(MPC* controller) {
+  if (controller) {
+    // The nominal controller is only read once the pool is built.
+    controller->Seed(nominal);
+    std::lock_guard<std::mutex> lock(mutex);
+    available.push_back(controller);
+  }
+}
+
+size_t ControllerPool::in_use() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return contexts.size() - available.size();
+}
@@ -0,0 +1,79 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "MPC.h"
+#include "structure.h"
+
+class Fleet;
+
+/*
+ Controllers for connections that come and go.
+
+ A fixed number of contexts is built at start-up, all on one shared
+ structure, with the previous solution, multipliers and linearisation
+ cache of RTI and LM sized in their constructors. None of them solves a
+ frame. Instead one nominal controller solves a typical frame once, and
+ every context handed out starts from a copy of that solution rather than
+ cold (MPC::Seed). Ipopt keeps nothing between frames, so with it the
+ nominal frame is skipped.
+
+ The pool also holds one connection context (a Fleet) per controller,
+ since every connection needs at least one. connect() takes a context
+ with the controller of its car already attached, so running out shows
+ at connect time and the server can turn the connection away. connect(),
+ acquire() and their counterparts only move pointers on and off free
+ lists and copy the nominal warm start into memory the context already
+ has. The pool never grows. The vehicles of a fleet frame after the first
+ take their controllers through acquire(), which does allocate a node
+ in the fleet's map of ids, and a solve still allocates its temporaries.
+
+ The free lists are guarded by a mutex, since mpc_uring connects on its
+ ring thread and solves, which take the controllers of new fleet
+ vehicles, on another. A Fleet itself is only ever used by one thread at
+ a time.
+ */
+class ControllerPool {
+ public:
+  ControllerPool(std::shared_ptr<const ProblemStructure> structure, size_t capacity = 256);
+  ~ControllerPool();
+
+  // A context for a new connection with the controller of its car taken,
+  // or null if no controller is free.
+  Fleet* connect();
+
+  // Hand a context from connect() back, with all of its controllers. Null
+  // is ignored.
+  void disconnect(Fleet* fleet);
+
+  // A context warm started from the nominal frame, or null if all of them
+  // are in use.
+  MPC* acquire();
+
+  // Hand a context from acquire() back. Null is ignored.
+  void release(MPC* controller);
+
+  size_t capacity() const { return contexts.size(); }
+  size_t in_use() const;
+
+ private:
+  std::shared_ptr<const ProblemStructure> structure;
+
+  // The frame every context starts from.
+  MPC nominal;
+
+  std::vector<std::unique_ptr<MPC>> contexts;
+  // Reserved for every context, so that release() never allocates.
+  std::vector<MPC*> available;
+
+  // Guards available and idle.
+  mutable std::mutex mutex;
+
+  // After the controllers, so that the connections give theirs back first.
+  std::vector<std::unique_ptr<Fleet>> connections;
+  std::vector<Fleet*> idle;
+};
+
+#endif /* POOL_H */
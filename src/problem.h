@@ -0,0 +1,95 @@
+#ifndef PROBLEM_H
+#define PROBLEM_H
+
+#include <cstddef>
+#include "MPC.h"
+
+/*
+ Definitions of the optimisation problem shared by the solvers: the
+ reference, the cost weights, the actuator limits and where each variable
+ sits in the solver's variable vector.
+ */
+
+// Both the reference cross track and orientation errors are 0.
+// The reference velocity is set to 20 mph.
+const double ref_v = 40 * 0.44704;
+
+// Weights of the cost terms: reference state, use of actuators and the
+// gap between sequential actuations.
+const double w_cte = 1;
+const double w_epsi = 200;
+const double w_v = 1;
+const double w_delta = 1;
+const double w_a = 1;
+const double w_ddelta = 1000;
+const double w_da = 1;
+
+// The upper and lower limits of delta are set to -25 and 25
+// degrees (values in radians), and of acceleration/decceleration to -1
+// and 1.
+// NOTE: Feel free to change this to something else.
+const double max_delta = 0.436332;
+const double max_a = 1.0;
+
+// Number of state variables and actuator variables in each stage.
+const size_t n_states = 6;
+const size_t n_actuators = 2;
+
+// The solver takes all the state variables and actuator
+// variables in a singular vector. Thus, we should to establish
+// when one variable starts and another ends to make our lifes easier.
+//
+// VarIndex maps (variable, timestep) to a position in that vector and
+// (state, timestep) to the row of the matching model constraint.
+//
+// states is the number of state variables per timestep: n_states, 4 for
+// Formulation::REDUCED, which has no cte and epsi (so cte() and epsi()
+// must not be used), or 0 for Formulation::SINGLE_SHOOTING, which only has
+// the actuations and no constraints.
+class VarIndex {
+ public:
+  VarIndex(size_t N, Layout layout, size_t states = n_states)
+      : N(N), layout(layout), states(states) {}
+
+  size_t x(size_t t) const { return at(0, t); }
+  size_t y(size_t t) const { return at(1, t); }
+  size_t psi(size_t t) const { return at(2, t); }
+  size_t v(size_t t) const { return at(3, t); }
+  size_t cte(size_t t) const { return at(4, t); }
+  size_t epsi(size_t t) const { return at(5, t); }
+  size_t delta(size_t t) const { return at(states, t); }
+  size_t a(size_t t) const { return at(states + 1, t); }
+
+  // Variable k of [x y psi v cte epsi delta a] at timestep t, or of
+  // [x y psi v delta a] with 4 states.
+  size_t at(size_t k, size_t t) const {
+    if (layout == Layout::STAGE_MAJOR) {
+      // [x y psi v cte epsi delta a] for every stage but the last,
+      // which has no actuations.
+      return t * (states + n_actuators) + k;
+    }
+    // [x... y... psi... v... cte... epsi... delta... a...]
+    if (k < states) {
+      return k * N + t;
+    }
+    return states * N + (k - states) * (N - 1) + t;
+  }
+
+  // Row of the constraint that defines state k at timestep t.
+  size_t row(size_t k, size_t t) const {
+    return layout == Layout::STAGE_MAJOR ? t * states + k : k * N + t;
+  }
+
+  // N timesteps == N - 1 actuations
+  size_t n_vars() const { return N * states + (N - 1) * n_actuators; }
+  size_t n_constraints() const { return N * states; }
+
+  size_t n_stage_states() const { return states; }
+
+ private:
+  size_t N;
+  Layout layout;
+  size_t states;
+};
+
+#endif /* PROBLEM_H */
@@ -0,0 +1,185 @@
+#include "profiler.h"
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <sstream>
+#include <vector>
+
+thread_local volatile Stage current_stage = Stage::OTHER;
+
+const char* stage_name(Stage stage) {
+  static const char* names[] = {"other", "parse", "fit", "taping", "ipopt", "rti", "lm", "serialise"};
+  const int i = static_cast<int>(stage);
+  return i >= 0 && i < static_cast<int>(Stage::N_STAGES) ? names[i] : "other";
+}
+
+namespace {
+
+const size_t capacity = 4096;  // a power of two
+const int max_depth = 64;
+// The handler's own frame and the signal trampoline's.
+const int skipped_frames = 2;
+
+struct Sample {
+  // Odd while the handler writes the sample, 2 * (its index + 1) once it is
+  // complete. Readers copy the sample between two equal even values.
+  std::atomic<uint64_t> sequence;
+  Stage stage;
+  int depth;
+  void* pcs[max_depth];
+};
+
+Sample* samples = nullptr;
+std::atomic<uint64_t> head(0);
+std::atomic<bool> running(false);
+
+void on_sigprof(int, siginfo_t*, void*) {
+  const int saved_errno = errno;
+  const uint64_t i = head.fetch_add(1, std::memory_order_relaxed);
+  Sample& s = samples[i & (capacity - 1)];
+  s.sequence.store(2 * i + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  s.stage = current_stage;
+  s.depth = backtrace(s.pcs, max_depth);
+  s.sequence.store(2 * i + 2, std::memory_order_release);
+  errno = saved_errno;
+}
+
+// A frame of a folded stack: the demangled function name without its
+// parameters, or the module and offset where there is no symbol (link
+// with -rdynamic to have the executable's own).
+std::string frame_name(void* pc) {
+  Dl_info info;
+  if (!dladdr(pc, &info) || !info.dli_fname) {
+    char name[32];
+    snprintf(name, sizeof(name), "%p", pc);
+    return name;
+  }
+  if (info.dli_sname) {
+    int status;
+    char* demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+    std::string name = status == 0 ? demangled : info.dli_sname;
+    free(demangled);
+    size_t end = name.size();
+    if (name.size() > 6 && name.compare(end - 6, 6, " const") == 0) {
+      end -= 6;
+    }
+    if (end > 0 && name[end - 1] == ')') {
+      int depth = 0;
+      for (size_t k = end; k-- > 0;) {
+        if (name[k] == ')') {
+          depth++;
+        } else if (name[k] == '(' && --depth == 0) {
+          name.erase(k);
+          break;
+        }
+      }
+    }
+    // Folded stacks use ';' between frames and ' ' before the count.
+    for (char& c : name) {
+      if (c == ';' || c == ' ') {
+        c = '_';
+      }
+    }
+    return name;
+  }
+  const char* module = strrchr(info.dli_fname, '/');
+  char offset[32];
+  snprintf(offset, sizeof(offset), "+0x%lx",
+           static_cast<unsigned long>(static_cast<char*>(pc) - static_cast<char*>(info.dli_fbase)));
+  return std::string(module ? module + 1 : info.dli_fname) + offset;
+}
+
+}  // namespace
+
+bool start_profiler(double hz) {
+  if (hz <= 0 || running.exchange(true)) {
+    return false;
+  }
+  if (!samples) {
+    samples = new Sample[capacity]();
+  }
+  // The first backtrace() loads the unwinder, which must not happen in the
+  // signal handler.
+  void* pcs[1];
+  backtrace(pcs, 1);
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_sigaction = on_sigprof;
+  action.sa_flags = SA_SIGINFO | SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  const long us = std::max(1L, static_cast<long>(std::lround(1e6 / hz)));
+  itimerval timer = {{us / 1000000, us % 1000000}, {us / 1000000, us % 1000000}};
+  if (sigaction(SIGPROF, &action, nullptr) != 0 || setitimer(ITIMER_PROF, &timer, nullptr) != 0) {
+    running = false;
+    return false;
+  }
+  return true;
+}
+
+void stop_profiler() {
+  if (!running.exchange(false)) {
+    return;
+  }
+  itimerval timer = {{0, 0}, {0, 0}};
+  setitimer(ITIMER_PROF, &timer, nullptr);
+  signal(SIGPROF, SIG_IGN);
+}
+
+std::string folded_profile() {
+  if (!samples) {
+    return "";
+  }
+  std::map<std::vector<void*>, size_t> stacks;
+  std::vector<void*> key;
+  const uint64_t end = head.load(std::memory_order_acquire);
+  const uint64_t begin = end > capacity ? end - capacity : 0;
+  for (uint64_t i = begin; i < end; i++) {
+    const Sample& s = samples[i & (capacity - 1)];
+    const uint64_t sequence = s.sequence.load(std::memory_order_acquire);
+    if (sequence != 2 * i + 2) {
+      // Still being written, or already overwritten.
+      continue;
+    }
+    const int depth = std::min(s.depth, max_depth);
+    key.assign(1, reinterpret_cast<void*>(static_cast<intptr_t>(s.stage)));
+    for (int k = depth - 1; k >= skipped_frames; k--) {
+      key.push_back(s.pcs[k]);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (s.sequence.load(std::memory_order_relaxed) == sequence) {
+      stacks[key]++;
+    }
+  }
+
+  // Return addresses point after their call, so the caller's frame is
+  // looked up one byte back; the interrupted frame, the last, is exact.
+  std::map<void*, std::string> names;
+  std::ostringstream out;
+  for (const auto& stack : stacks) {
+    const std::vector<void*>& pcs = stack.first;
+    out << stage_name(static_cast<Stage>(reinterpret_cast<intptr_t>(pcs[0])));
+    for (size_t k = 1; k < pcs.size(); k++) {
+      void* pc = k + 1 < pcs.size() ? static_cast<char*>(pcs[k]) - 1 : pcs[k];
+      auto name = names.find(pc);
+      if (name == names.end()) {
+        name = names.insert({pc, frame_name(pc)}).first;
+      }
+      out << ';' << name->second;
+    }
+    out << ' ' << stack.second << '\n';
+  }
+  return out.str();
+}
@@ -0,0 +1,67 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <string>
+
+/*
+ Sampling profiler for the servers, for when perf is not available.
+
+ Opt in with start_profiler(): a timer then interrupts the process every
+ 1/hz seconds of CPU time (SIGPROF), on whichever thread is running. The
+ signal handler records the stack and that thread's pipeline stage into a
+ ring of samples. It takes no lock and does not allocate; when the ring is
+ full the oldest samples are overwritten. Blocked threads use no CPU time,
+ so an idle server takes no samples.
+
+ folded_profile() turns the samples into folded stacks, one line per
+ distinct stack with the stage as its root frame,
+
+   fit;main;...;polyfit 12
+
+ the input of flamegraph.pl and most flame graph viewers; grep a stage to
+ get its own graph. The servers serve it at /profile.
+ */
+
+// What a thread is doing, as far as the profile is concerned.
+enum class Stage : int {
+  OTHER,      // event loop, framing, anything untagged
+  PARSE,      // JSON parse of a message
+  FIT,        // latency prediction, waypoint transform and polyfit
+  TAPING,     // CppAD recording the objective and constraints
+  IPOPT,      // Ipopt iterations, with CppAD's derivatives
+  RTI,        // a real-time iteration step (rti.h)
+  LM,         // the Levenberg-Marquardt solve (lm.h)
+  SERIALISE,  // building and dumping the reply
+  N_STAGES
+};
+
+const char* stage_name(Stage stage);
+
+// The calling thread's stage. Only the thread itself writes it, and reads
+// from the signal handler are of a single int.
+extern thread_local volatile Stage current_stage;
+
+// Tags the calling thread with stage for the lifetime of the scope, and
+// restores the stage it had before.
+class StageScope {
+ public:
+  explicit StageScope(Stage stage) : previous(current_stage) { current_stage = stage; }
+  ~StageScope() { current_stage = previous; }
+
+ private:
+  StageScope(const StageScope&) = delete;
+  StageScope& operator=(const StageScope&) = delete;
+
+  Stage previous;
+};
+
+// Start sampling at hz samples per CPU second. False if the timer or the
+// signal handler could not be set up, or it is already running.
+bool start_profiler(double hz);
+
+void stop_profiler();
+
+// Folded stacks of the samples in the ring, empty if it never ran.
+std::string folded_profile();
+
+#endif /* PROFILER_H */
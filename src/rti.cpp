@@ -0,0 +1,289 @@
+#include "rti.h"
+#include <cmath>
+#include <iostream>
+#include <utility>
+#include <vector>
+#include "Eigen-3.3/Eigen/SparseLU"
+#include "Eigen-3.3/unsupported/Eigen/IterativeSolvers"
+
+typedef Eigen::Triplet<double> Triplet;
+
+RTISolver::RTISolver(const ProblemStructure& structure)
+    : config(structure.config), idx(structure.idx), H(structure.H), q(structure.q),
+      cost_offset(structure.cost_offset), hessian_blocks(structure.hessian_blocks),
+      previous(Eigen::VectorXd::Zero(idx.n_vars())), warm(false), last_cost(0), last_iterations(0),
+      cache(config.N - 1, config.dt, config.integrator, config.relinearise_tolerance,
+            structure.table.get()) {}
+
+void RTISolver::Reset() {
+  warm = false;
+  cache.clear();
+}
+
+void RTISolver::Seed(const RTISolver& nominal) {
+  previous = nominal.previous;
+  warm = nominal.warm;
+  last_cost = nominal.last_cost;
+  last_iterations = 0;
+  cache = nominal.cache;
+}
+
+Eigen::VectorXd shift_solution(const Eigen::VectorXd& previous, const MPCConfig& config,
+                               double elapsed, Eigen::Vector3d& origin) {
+  const size_t N = config.N;
+  VarIndex idx(N, config.layout);
+  Eigen::VectorXd w = Eigen::VectorXd::Zero(idx.n_vars());
+  const double shift = std::max(0.0, elapsed / config.dt);
+
+  // The previous states, carried on past the end of the horizon with the
+  // last actuations held, far enough for every new timestep.
+  const size_t n_points = N + static_cast<size_t>(ceil(shift));
+  std::vector<Eigen::Matrix<double, 6, 1>> points(n_points);
+  for (size_t t = 0; t < n_points; t++) {
+    if (t < N) {
+      for (size_t k = 0; k < n_states; k++) {
+        points[t][k] = previous[idx.at(k, t)];
+      }
+      continue;
+    }
+    VehicleState<double> s = {points[t - 1][0], points[t - 1][1], points[t - 1][2],
+                              points[t - 1][3]};
+    s = step(s, previous[idx.delta(N - 2)], previous[idx.a(N - 2)], config.dt, config.integrator);
+    points[t] << s.x, s.y, s.psi, s.v, points[t - 1][4], points[t - 1][5];
+  }
+  // The previous solution at fractional timestep f, linear in between.
+  auto at = [&](double f) {
+    size_t t0 = std::min(static_cast<size_t>(f), n_points - 2);
+    double u = f - t0;
+    return Eigen::Matrix<double, 6, 1>((1 - u) * points[t0] + u * points[t0 + 1]);
+  };
+
+  // The car is now about where the previous solution put it `elapsed`
+  // seconds ahead, so that point is the origin of the new frame.
+  Eigen::Matrix<double, 6, 1> now = at(shift);
+  origin = Eigen::Vector3d(now[0], now[1], now[2]);
+  double c = cos(origin[2]);
+  double s = sin(origin[2]);
+
+  for (size_t t = 0; t < N; t++) {
+    Eigen::Matrix<double, 6, 1> p = at(t + shift);
+    double dx = p[0] - origin[0];
+    double dy = p[1] - origin[1];
+    w[idx.x(t)] = dx * c + dy * s;
+    w[idx.y(t)] = -dx * s + dy * c;
+    w[idx.psi(t)] = p[2] - origin[2];
+    w[idx.v(t)] = p[3];
+    w[idx.cte(t)] = p[4];
+    w[idx.epsi(t)] = p[5];
+  }
+  // Each new step takes the actuations in force at its middle, the last
+  // ones past the end of the previous horizon.
+  for (size_t t = 0; t + 1 < N; t++) {
+    size_t from = std::min(static_cast<size_t>(t + shift + 0.5), N - 2);
+    w[idx.delta(t)] = previous[idx.delta(from)];
+    w[idx.a(t)] = previous[idx.a(from)];
+  }
+  return w;
+}
+
+Eigen::VectorXd coasting_solution(const Eigen::VectorXd& state, const MPCConfig& config) {
+  VarIndex idx(config.N, config.layout);
+  Eigen::VectorXd w = Eigen::VectorXd::Zero(idx.n_vars());
+
+  VehicleState<double> s = {state[0], state[1], state[2], state[3]};
+  for (size_t t = 0; t < config.N; t++) {
+    w[idx.x(t)] = s.x;
+    w[idx.y(t)] = s.y;
+    w[idx.psi(t)] = s.psi;
+    w[idx.v(t)] = s.v;
+    w[idx.cte(t)] = state[4];
+    w[idx.epsi(t)] = state[5];
+    s = step(s, 0.0, 0.0, config.dt, config.integrator);
+  }
+  return w;
+}
+
+Eigen::VectorXd RTISolver::operating_point(const Eigen::VectorXd& state, double elapsed) {
+  Eigen::VectorXd w;
+  if (warm && elapsed < config.dt * (config.N - 1)) {
+    Eigen::Vector3d origin;
+    w = shift_solution(previous, config, elapsed, origin);
+    cache.shift(origin, static_cast<size_t>(lround(std::max(0.0, elapsed / config.dt))));
+  } else {
+    w = coasting_solution(state, config);
+    cache.clear();
+  }
+
+  for (size_t k = 0; k < n_states; k++) {
+    w[idx.at(k, 0)] = state[k];
+  }
+  return w;
+}
+
+vector<double> RTISolver::Solve(const Eigen::VectorXd& state, const Eigen::VectorXd& coeffs,
+                                double elapsed) {
+  const size_t N = config.N;
+  const size_t n_vars = idx.n_vars();
+
+  Eigen::VectorXd wbar = operating_point(state, elapsed);
+
+  // Linearised model constraints, C w = b.
+  StageConstraints C(N, config.layout);
+
+  // Initial state.
+  for (size_t k = 0; k < n_states; k++) {
+    C.b[idx.row(k, 0)] = state[k];
+  }
+
+  for (size_t t = 0; t + 1 < N; t++) {
+    Eigen::Vector4d s(wbar[idx.x(t)], wbar[idx.y(t)], wbar[idx.psi(t)], wbar[idx.v(t)]);
+    Eigen::Vector2d u(wbar[idx.delta(t)], wbar[idx.a(t)]);
+    Eigen::Matrix<double, 8, 1> z;
+    for (size_t k = 0; k < n_states + n_actuators; k++) {
+      z[k] = wbar[idx.at(k, t)];
+    }
+
+    // [x y psi v cte epsi] at t + 1 ~ g + J * (z' - z)
+    Eigen::Matrix<double, 6, 1> g;
+    linearise_stage(z, cache.get(t, s, u), coeffs, config.dt, config.integrator, g, C.J[t]);
+    Eigen::Matrix<double, 6, 1> d = g - C.J[t] * z;
+
+    for (size_t k = 0; k < n_states; k++) {
+      C.b[idx.row(k, t + 1)] = d[k];
+    }
+  }
+
+  // Actuations fixed at their limit go to C.fixed.
+  Eigen::VectorXd w;
+  // The solution [w; multipliers] of the last pass, and the starting point
+  // of the next MINRES pass.
+  Eigen::VectorXd solution;
+  Eigen::VectorXd guess;
+  last_iterations = 0;
+
+  const int max_passes = 5;
+  for (int pass = 0; pass < max_passes; pass++) {
+    if (config.kkt_solver == KKTSolver::MINRES) {
+      // Any rho gives the same solution. The larger it is, the closer the
+      // preconditioner gets to the inverse: ~20 iterations at any N here,
+      // against several hundred with rho = 100.
+      const double rho = 1e6;
+      AugmentedKKT K(H, hessian_blocks, C, rho);
+      Eigen::MINRES<AugmentedKKT, Eigen::Lower | Eigen::Upper, StagePreconditioner> minres;
+      minres.setTolerance(config.kkt_tolerance);
+      minres.setMaxIterations(20 * K.rows());
+      minres.compute(K);
+
+      // Start from the operating point, or from the last pass.
+      if (pass == 0) {
+        guess = Eigen::VectorXd::Zero(K.rows());
+        guess.head(n_vars) = wbar;
+      }
+      solution = minres.solveWithGuess(K.rhs(q), guess);
+      last_iterations += minres.iterations();
+      if (minres.info() != Eigen::Success) {
+        std::cerr << "RTI: MINRES did not converge, residual " << minres.error() << std::endl;
+      }
+    } else {
+      // KKT system [H C'; C 0] [w; lambda] = [-q; b].
+      size_t m = C.rows();
+      std::vector<Triplet> k;
+      for (int col = 0; col < H.outerSize(); col++) {
+        for (Eigen::SparseMatrix<double>::InnerIterator it(H, col); it; ++it) {
+          k.push_back(Triplet(it.row(), it.col(), it.value()));
+        }
+      }
+      for (const Triplet& e : C.triplets()) {
+        k.push_back(Triplet(n_vars + e.row(), e.col(), e.value()));
+        k.push_back(Triplet(e.col(), n_vars + e.row(), e.value()));
+      }
+      Eigen::VectorXd rhs(n_vars + m);
+      rhs.head(n_vars) = -q;
+      rhs.tail(m) = C.rhs();
+
+      Eigen::SparseMatrix<double> K(n_vars + m, n_vars + m);
+      K.setFromTriplets(k.begin(), k.end());
+
+      Eigen::SparseLU<Eigen::SparseMatrix<double>> lu;
+      lu.compute(K);
+      if (lu.info() != Eigen::Success) {
+        std::cerr << "RTI: KKT factorisation failed" << std::endl;
+        break;
+      }
+      solution = lu.solve(rhs);
+    }
+    w = solution.head(n_vars);
+
+    // Update the active set. With H w + q + C' lambda = 0, the multiplier
+    // of an actuation fixed at its upper limit is that of the bound and
+    // must not be negative, and at the lower limit it must not be
+    // positive; otherwise the cost would rather move it back inside, and
+    // it is released. Actuations that ended up outside their limits are
+    // fixed. Multipliers carry over to the next MINRES pass.
+    const size_t n_model = idx.n_constraints();
+    std::vector<std::pair<size_t, double>> fixed;
+    std::vector<double> fixed_multipliers;
+    bool changed = false;
+    for (size_t i = 0; i < C.fixed.size(); i++) {
+      double multiplier = solution[n_vars + n_model + i];
+      if (multiplier * C.fixed[i].second < -1e-9) {
+        changed = true;
+      } else {
+        fixed.push_back(C.fixed[i]);
+        fixed_multipliers.push_back(multiplier);
+      }
+    }
+    for (size_t t = 0; t < N - 1; t++) {
+      size_t vars[2] = {idx.delta(t), idx.a(t)};
+      double limits[2] = {max_delta, max_a};
+      for (int j = 0; j < 2; j++) {
+        if (fabs(w[vars[j]]) > limits[j] + 1e-9) {
+          fixed.push_back(std::make_pair(vars[j], w[vars[j]] > 0 ? limits[j] : -limits[j]));
+          fixed_multipliers.push_back(0);
+          changed = true;
+        }
+      }
+    }
+    if (!changed) {
+      break;
+    }
+    C.fixed = fixed;
+    guess = Eigen::VectorXd::Zero(n_vars + C.rows());
+    guess.head(n_vars + n_model) = solution.head(n_vars + n_model);
+    for (size_t i = 0; i < fixed.size(); i++) {
+      guess[n_vars + n_model + i] = fixed_multipliers[i];
+    }
+  }
+
+  if (w.size() == 0 || !w.allFinite()) {
+    // Start again from a coasting trajectory on the next frame.
+    w = wbar;
+    warm = false;
+  } else {
+    warm = true;
+  }
+
+  // Stay within the limits even if the passes ran out.
+  for (size_t t = 0; t < N - 1; t++) {
+    w[idx.delta(t)] = std::max(-max_delta, std::min(max_delta, w[idx.delta(t)]));
+    w[idx.a(t)] = std::max(-max_a, std::min(max_a, w[idx.a(t)]));
+  }
+
+  previous = w;
+  last_cost = 0.5 * w.dot(H * w) + q.dot(w) + cost_offset;
+
+  vector<double> result;
+
+  // Return the first actuator values.
+  result.push_back(w[idx.delta(0)]);
+  result.push_back(w[idx.a(0)]);
+
+  // Return the predicted path
+  for (size_t i = 0; i < N - 1; i++)
+    result.push_back(w[idx.x(i + 1)]);
+
+  for (size_t i = 0; i < N - 1; i++)
+    result.push_back(w[idx.y(i + 1)]);
+
+  return result;
+}
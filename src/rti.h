@@ -0,0 +1,90 @@
+#ifndef RTI_H
+#define RTI_H
+
+#include <vector>
+#include "Eigen-3.3/Eigen/Core"
+#include "Eigen-3.3/Eigen/SparseCore"
+#include "MPC.h"
+#include "kkt.h"
+#include "linearisation.h"
+#include "problem.h"
+#include "structure.h"
+
+// Warm start: the previous solution moved elapsed seconds forward, which
+// need not be a whole number of timesteps (the states are interpolated in
+// between), and into the frame whose origin is the car's predicted
+// position at that time, which is set to (x, y, psi) of that point in the
+// old frame. The last actuations are held past the end of the previous
+// horizon.
+Eigen::VectorXd shift_solution(const Eigen::VectorXd& previous, const MPCConfig& config,
+                               double elapsed, Eigen::Vector3d& origin);
+
+// Cold start: zero actuations from the measured state.
+Eigen::VectorXd coasting_solution(const Eigen::VectorXd& state, const MPCConfig& config);
+
+/*
+ Real-time iteration: one Gauss-Newton SQP step per frame instead of a
+ full Ipopt solve.
+
+ The model is linearised along the previous solution, shifted by the time
+ since the previous frame, and the resulting equality constrained QP is
+ solved through its KKT system, either factorised or iteratively (see
+ kkt.h). The cost is already quadratic in the variables, so only the
+ model constraints change from frame to frame. Actuator limits are
+ handled by an active set: the actuations that end up outside them are
+ fixed at the limit, the fixed ones whose multiplier says they would move
+ back inside are released, and the QP is solved again until the set
+ settles.
+ */
+class RTISolver {
+ public:
+  // structure must outlive the solver.
+  explicit RTISolver(const ProblemStructure& structure);
+
+  // Same arguments and result layout as MPC::Solve. elapsed must not be
+  // negative.
+  vector<double> Solve(const Eigen::VectorXd& state, const Eigen::VectorXd& coeffs,
+                       double elapsed);
+
+  // Forget the previous solution: the next Solve starts cold, as on a new
+  // solver, but keeps the memory already allocated.
+  void Reset();
+
+  // Take over the previous solution and linearisations of nominal, a
+  // solver on the same structure, as if its frame had been this one's.
+  // Copies into the memory already allocated.
+  void Seed(const RTISolver& nominal);
+
+  // Cost of the last solution.
+  double cost() const { return last_cost; }
+
+  const LinearisationCache& linearisations() const { return cache; }
+
+  // MINRES iterations of the last solve.
+  size_t kkt_iterations() const { return last_iterations; }
+
+ private:
+  const MPCConfig& config;
+  const VarIndex& idx;
+
+  // Cost 0.5 * w'Hw + q'w + cost_offset over the variables w.
+  const Eigen::SparseMatrix<double>& H;
+  const Eigen::VectorXd& q;
+  const double cost_offset;
+  const StageHessian& hessian_blocks;
+
+  // Previous solution, the operating trajectory of the next frame.
+  Eigen::VectorXd previous;
+  bool warm;
+  double last_cost;
+  size_t last_iterations;
+
+  LinearisationCache cache;
+
+  // Trajectory to linearise along: the previous solution shifted by
+  // elapsed seconds, or a rollout with zero actuations on the first frame
+  // and when more than the horizon has gone by.
+  Eigen::VectorXd operating_point(const Eigen::VectorXd& state, double elapsed);
+};
+
+#endif /* RTI_H */
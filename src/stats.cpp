@@ -0,0 +1,193 @@
+#include "stats.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <numeric>
+#include <random>
+
+double percentile(std::vector<double> samples, double p) {
+  size_t i = static_cast<size_t>(p * (samples.size() - 1) + 0.5);
+  std::nth_element(samples.begin(), samples.begin() + i, samples.end());
+  return samples[i];
+}
+
+static double mean(const std::vector<double>& samples) {
+  return std::accumulate(samples.begin(), samples.end(), 0.0) / samples.size();
+}
+
+size_t warmup_length(const std::vector<double>& run) {
+  const size_t batch = 5;
+  const size_t n = run.size() / batch;
+  if (n < 4) {
+    return 0;
+  }
+  std::vector<double> batches(n);
+  for (size_t b = 0; b < n; b++) {
+    batches[b] = std::accumulate(run.begin() + b * batch, run.begin() + (b + 1) * batch, 0.0) / batch;
+  }
+
+  // MSER(d) = sum over b >= d of (batches[b] - mean)^2 / (n - d)^2, from
+  // running sums over the tail.
+  double sum = 0, sum_squares = 0;
+  double best = INFINITY;
+  size_t best_d = 0;
+  for (size_t d = n; d-- > 0;) {
+    sum += batches[d];
+    sum_squares += batches[d] * batches[d];
+    const double m = n - d;
+    const double mser = (sum_squares - sum * sum / m) / (m * m);
+    if (d <= n / 2 && mser <= best) {
+      best = mser;
+      best_d = d;
+    }
+  }
+  return best_d * batch;
+}
+
+std::vector<double> without_outliers(const std::vector<double>& samples) {
+  if (samples.size() < 4) {
+    return samples;
+  }
+  const double q1 = percentile(samples, 0.25);
+  const double q3 = percentile(samples, 0.75);
+  const double low = q1 - 3 * (q3 - q1);
+  const double high = q3 + 3 * (q3 - q1);
+  std::vector<double> kept;
+  for (double s : samples) {
+    if (s >= low && s <= high) {
+      kept.push_back(s);
+    }
+  }
+  return kept;
+}
+
+// Bootstrap of statistic(a, b) over resamples of a and b, each of its own
+// size.
+static Interval bootstrap_pair(
+    const std::vector<double>& a, const std::vector<double>& b,
+    const std::function<double(const std::vector<double>&, const std::vector<double>&)>& statistic,
+    double confidence, size_t resamples) {
+  std::mt19937 gen(1);
+  std::uniform_int_distribution<size_t> pick_a(0, a.size() - 1);
+  std::uniform_int_distribution<size_t> pick_b(0, b.empty() ? 0 : b.size() - 1);
+  std::vector<double> ra(a.size()), rb(b.size());
+  std::vector<double> values(resamples);
+  for (size_t r = 0; r < resamples; r++) {
+    for (double& x : ra) {
+      x = a[pick_a(gen)];
+    }
+    for (double& x : rb) {
+      x = b[pick_b(gen)];
+    }
+    values[r] = statistic(ra, rb);
+  }
+  const double tail = (1 - confidence) / 2;
+  return {percentile(values, tail), percentile(values, 1 - tail)};
+}
+
+Interval bootstrap(const std::vector<double>& samples,
+                   const std::function<double(const std::vector<double>&)>& statistic,
+                   double confidence, size_t resamples) {
+  if (samples.empty()) {
+    return {NAN, NAN};
+  }
+  return bootstrap_pair(samples, {},
+                        [&](const std::vector<double>& a, const std::vector<double>&) {
+                          return statistic(a);
+                        },
+                        confidence, resamples);
+}
+
+static double p99(const std::vector<double>& samples) { return percentile(samples, 0.99); }
+
+Summary summarise(const std::vector<double>& samples, double confidence) {
+  Summary s;
+  s.count = samples.size();
+  if (samples.empty()) {
+    return s;
+  }
+  const std::vector<double> kept = without_outliers(samples);
+  s.outliers = samples.size() - kept.size();
+  s.mean = mean(kept);
+  s.mean_interval = bootstrap(kept, mean, confidence);
+  s.median = percentile(samples, 0.5);
+  s.p99 = p99(samples);
+  s.p99_interval = bootstrap(samples, p99, confidence);
+  return s;
+}
+
+bool write_results(const std::string& path, const Results& results) {
+  std::ofstream out(path);
+  out.precision(9);
+  out << "# mpc_bench results: a name per line, then the sample count and the samples in ms"
+      << std::endl;
+  for (const auto& r : results) {
+    out << r.first << std::endl << r.second.size();
+    for (double s : r.second) {
+      out << ' ' << s;
+    }
+    out << std::endl;
+  }
+  return bool(out);
+}
+
+bool read_results(const std::string& path, Results& results) {
+  std::ifstream in(path);
+  std::string name;
+  while (std::getline(in, name)) {
+    if (name.empty() || name[0] == '#') {
+      continue;
+    }
+    size_t count = 0;
+    in >> count;
+    std::vector<double>& samples = results[name];
+    samples.resize(count);
+    for (double& s : samples) {
+      in >> s;
+    }
+    in.ignore(1);
+    if (!in) {
+      return false;
+    }
+  }
+  return in.eof();
+}
+
+static Change compare(const std::vector<double>& base, const std::vector<double>& candidate,
+                      const std::function<double(const std::vector<double>&)>& statistic,
+                      double confidence) {
+  Change c;
+  c.base = statistic(base);
+  c.candidate = statistic(candidate);
+  c.relative = c.candidate / c.base - 1;
+  c.interval = bootstrap_pair(base, candidate,
+                              [&](const std::vector<double>& b, const std::vector<double>& a) {
+                                return statistic(a) / statistic(b) - 1;
+                              },
+                              confidence, 2000);
+  c.verdict = c.interval.low > 0    ? Verdict::REGRESSION
+              : c.interval.high < 0 ? Verdict::IMPROVEMENT
+                                    : Verdict::NO_CHANGE;
+  return c;
+}
+
+Change compare_mean(const std::vector<double>& base, const std::vector<double>& candidate,
+                    double confidence) {
+  return compare(without_outliers(base), without_outliers(candidate), mean, confidence);
+}
+
+Change compare_p99(const std::vector<double>& base, const std::vector<double>& candidate,
+                   double confidence) {
+  return compare(base, candidate, p99, confidence);
+}
+
+const char* verdict_name(Verdict verdict) {
+  switch (verdict) {
+    case Verdict::IMPROVEMENT:
+      return "improvement";
+    case Verdict::REGRESSION:
+      return "regression";
+    default:
+      return "no change";
+  }
+}
@@ -0,0 +1,82 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+/*
+ Statistics for the benchmark, so that two runs can be told apart from
+ noise.
+
+ - Warm-up: the first solves of a run are slower (cold caches, first
+   allocations, frequency scaling). warmup_length() finds where a run
+   settles with MSER-5: the truncation point that minimises the standard
+   error of the mean of what is left, in batches of 5 samples.
+ - Outliers: samples beyond Tukey's far-out fences, 3 interquartile
+   ranges outside the quartiles, are left out of the mean only. The p99 is
+   about the tail, so it keeps them.
+ - Confidence intervals: percentile bootstrap with a fixed seed, so the
+   same samples always give the same interval.
+ */
+
+// p-quantile, p in [0, 1], nearest rank.
+double percentile(std::vector<double> samples, double p);
+
+// Number of samples at the start of run to drop as warm-up, at most half.
+size_t warmup_length(const std::vector<double>& run);
+
+// samples without the far-out outliers.
+std::vector<double> without_outliers(const std::vector<double>& samples);
+
+struct Interval {
+  double low;
+  double high;
+};
+
+// Confidence interval of statistic(samples) by bootstrap resampling.
+Interval bootstrap(const std::vector<double>& samples,
+                   const std::function<double(const std::vector<double>&)>& statistic,
+                   double confidence, size_t resamples = 2000);
+
+struct Summary {
+  size_t count = 0;
+  size_t outliers = 0;
+  double mean = 0;  // without outliers
+  Interval mean_interval = {0, 0};
+  double median = 0;
+  double p99 = 0;
+  Interval p99_interval = {0, 0};
+};
+
+Summary summarise(const std::vector<double>& samples, double confidence);
+
+// Samples by name, as written by --output and read by --compare.
+typedef std::map<std::string, std::vector<double>> Results;
+
+bool write_results(const std::string& path, const Results& results);
+bool read_results(const std::string& path, Results& results);
+
+enum class Verdict { NO_CHANGE, IMPROVEMENT, REGRESSION };
+
+// Relative change from base to candidate, e.g. +0.05 for 5% slower, and
+// its confidence interval. The verdict is a change only when the interval
+// does not contain 0.
+struct Change {
+  double base;
+  double candidate;
+  double relative;
+  Interval interval;
+  Verdict verdict;
+};
+
+// Of the mean (without outliers) and of the p99.
+Change compare_mean(const std::vector<double>& base, const std::vector<double>& candidate,
+                    double confidence);
+Change compare_p99(const std::vector<double>& base, const std::vector<double>& candidate,
+                   double confidence);
+
+const char* verdict_name(Verdict verdict);
+
+#endif /* STATS_H */
@@ -0,0 +1,221 @@
+#include "structure.h"
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include "Eigen-3.3/Eigen/Eigenvalues"
+#include "lm.h"
+#include "lqr.h"
+#include "structure_cache.h"
+
+typedef Eigen::Triplet<double> Triplet;
+
+// Weight of the terminal cost, computed once per configuration.
+//
+// Around the reference (straight ahead at ref_v) the error states
+// z = [cte, epsi, v - ref_v] follow
+//
+//   cte[t+1] = cte[t] + ref_v * epsi[t] * dt
+//   epsi[t+1] = epsi[t] + ref_v / Lf * delta[t] * dt
+//   (v - ref_v)[t+1] = (v - ref_v)[t] + a[t] * dt
+//
+// and the LQR value function z'Pz of that system with the stage weights
+// above approximates the cost of driving on after the horizon. The last
+// timestep already pays its stage cost inside the horizon, so the terminal
+// weight is P - Q. The actuation gap terms are left out of the LQR, which
+// makes the estimate a slight under-estimate.
+static Eigen::MatrixXd terminal_weight(double dt) {
+  Eigen::MatrixXd A = Eigen::MatrixXd::Identity(3, 3);
+  A(0, 1) = ref_v * dt;
+
+  Eigen::MatrixXd B = Eigen::MatrixXd::Zero(3, 2);
+  B(1, 0) = ref_v / Lf * dt;
+  B(2, 1) = dt;
+
+  Eigen::MatrixXd Q = Eigen::MatrixXd::Zero(3, 3);
+  Q.diagonal() << w_cte, w_epsi, w_v;
+
+  Eigen::MatrixXd R = Eigen::MatrixXd::Zero(2, 2);
+  R.diagonal() << w_delta, w_a;
+
+  return solve_dare(A, B, Q, R) - Q;
+}
+
+// Whether the structure of config has a linearisation table.
+static bool has_table(const MPCConfig& config) {
+  return config.solver == Solver::RTI && config.linearisation_table;
+}
+
+ProblemStructure::ProblemStructure(const MPCConfig& config)
+    : ProblemStructure(config,
+                       config.terminal_cost ? terminal_weight(config.dt) : Eigen::MatrixXd(),
+                       std::unique_ptr<LinearisationTable>(
+                           has_table(config) ? new LinearisationTable(config.dt) : nullptr)) {}
+
+ProblemStructure::ProblemStructure(const MPCConfig& config, const Eigen::MatrixXd& terminal,
+                                   std::unique_ptr<LinearisationTable> table)
+    : config(config),
+      idx(config.N, config.layout),
+      terminal(terminal),
+      table(std::move(table)),
+      nlp_idx(config.N, config.layout,
+              config.formulation == Formulation::REDUCED           ? 4
+              : config.formulation == Formulation::SINGLE_SHOOTING ? 0
+                                                                   : n_states) {
+  const size_t N = config.N;
+  const size_t n_vars = idx.n_vars();
+
+  // The cost terms of FG_eval, one row each.
+  std::vector<Triplet> c;
+  std::vector<double> target;
+  auto add = [&](double weight, size_t var, double ref) {
+    c.push_back(Triplet(target.size(), var, sqrt(2 * weight)));
+    target.push_back(sqrt(2 * weight) * ref);
+  };
+
+  for (size_t t = 0; t < N; t++) {
+    add(w_cte, idx.cte(t), 0);
+    add(w_epsi, idx.epsi(t), 0);
+    add(w_v, idx.v(t), ref_v);
+  }
+  for (size_t t = 0; t < N - 1; t++) {
+    add(w_delta, idx.delta(t), 0);
+    add(w_a, idx.a(t), 0);
+  }
+  for (size_t t = 0; t < N - 2; t++) {
+    size_t pairs[2][2] = {{idx.delta(t), idx.delta(t + 1)}, {idx.a(t), idx.a(t + 1)}};
+    double weights[2] = {w_ddelta, w_da};
+    for (int k = 0; k < 2; k++) {
+      c.push_back(Triplet(target.size(), pairs[k][0], -sqrt(2 * weights[k])));
+      c.push_back(Triplet(target.size(), pairs[k][1], sqrt(2 * weights[k])));
+      target.push_back(0);
+    }
+  }
+
+  if (terminal.size() > 0) {
+    // terminal = V D V', so S = sqrt(D) V' has S'S = terminal and the
+    // terminal cost is |S z|^2.
+    Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> eigen(terminal);
+    Eigen::MatrixXd terminal_sqrt =
+        eigen.eigenvalues().cwiseMax(0.0).cwiseSqrt().asDiagonal() *
+        eigen.eigenvectors().transpose();
+    size_t z[3] = {idx.cte(N - 1), idx.epsi(N - 1), idx.v(N - 1)};
+    for (int i = 0; i < 3; i++) {
+      for (int j = 0; j < 3; j++) {
+        c.push_back(Triplet(target.size(), z[j], sqrt(2.0) * terminal_sqrt(i, j)));
+      }
+      target.push_back(sqrt(2.0) * terminal_sqrt(i, 2) * ref_v);
+    }
+  }
+
+  cost_matrix.resize(target.size(), n_vars);
+  cost_matrix.setFromTriplets(c.begin(), c.end());
+  cost_target = Eigen::Map<Eigen::VectorXd>(target.data(), target.size());
+
+  // |Lw - r|^2 / 2 = 0.5 * w'L'Lw - r'Lw + r'r / 2
+  H = cost_matrix.transpose() * cost_matrix;
+  q = -(cost_matrix.transpose() * cost_target);
+  cost_offset = 0.5 * cost_target.squaredNorm();
+  hessian_blocks = StageHessian(H, N, config.layout);
+  if (config.solver == Solver::LEVENBERG_MARQUARDT) {
+    lm_jacobian = constant_jacobian(config, idx, cost_matrix);
+  }
+
+  //
+  // NOTE: You don't have to worry about these options
+  //
+  // options for IPOPT solver
+  // Uncomment this if you'd like more print information
+  ipopt_options += "Integer print_level  0\n";
+  // NOTE: Setting sparse to true allows the solver to take advantage
+  // of sparse routines, this makes the computation MUCH FASTER. If you
+  // can uncomment 1 of these and see if it makes a difference or not but
+  // if you uncomment both the computation time should go up in orders of
+  // magnitude.
+  ipopt_options += "Sparse  true        forward\n";
+  ipopt_options += "Sparse  true        reverse\n";
+  // NOTE: Currently the solver has a maximum time limit of 0.5 seconds.
+  // Change this as you see fit.
+  ipopt_options += "Numeric max_cpu_time          0.5\n";
+  // Extra options (e.g. timing statistics from the benchmark) override
+  // the ones above.
+  ipopt_options += config.ipopt_options;
+
+  // Set all non-actuators upper and lowerlimits
+  // to the max negative and positive values.
+  vars_lowerbound.assign(nlp_idx.n_vars(), -1.0e19);
+  vars_upperbound.assign(nlp_idx.n_vars(), 1.0e19);
+  for (size_t t = 0; t < N - 1; t++) {
+    vars_lowerbound[nlp_idx.delta(t)] = -max_delta;
+    vars_upperbound[nlp_idx.delta(t)] = max_delta;
+    vars_lowerbound[nlp_idx.a(t)] = -max_a;
+    vars_upperbound[nlp_idx.a(t)] = max_a;
+  }
+}
+
+// Every structure handed out, by key. Weak references only: a structure
+// goes away with its last controller.
+static std::shared_ptr<const ProblemStructure> shared_structure(
+    const MPCConfig& config, std::function<std::shared_ptr<const ProblemStructure>()> build) {
+  static std::mutex mutex;
+  static std::map<std::string, std::weak_ptr<const ProblemStructure>> shared;
+
+  const std::string k = ProblemStructure::key(config);
+  std::lock_guard<std::mutex> lock(mutex);
+  std::shared_ptr<const ProblemStructure> structure = shared[k].lock();
+  if (!structure) {
+    for (auto it = shared.begin(); it != shared.end();) {
+      it = it->second.expired() ? shared.erase(it) : std::next(it);
+    }
+    structure = build();
+    shared[k] = structure;
+  }
+  return structure;
+}
+
+std::shared_ptr<const ProblemStructure> ProblemStructure::get(const MPCConfig& config) {
+  return shared_structure(config, [&] { return std::make_shared<const ProblemStructure>(config); });
+}
+
+std::shared_ptr<const ProblemStructure> ProblemStructure::get(
+    const MPCConfig& config, const std::string& cache_directory) {
+  if (cache_directory.empty() || !has_table(config)) {
+    return get(config);
+  }
+  return shared_structure(config, [&] {
+    const std::string path = structure_cache_path(cache_directory, config);
+    std::shared_ptr<const ProblemStructure> structure = load_structure(config, path);
+    if (!structure) {
+      structure = std::make_shared<const ProblemStructure>(config);
+      if (!save_structure(*structure, path)) {
+        std::cerr << "Could not write the structure cache " << path << std::endl;
+      }
+    }
+    return structure;
+  });
+}
+
+std::string ProblemStructure::key(const MPCConfig& config) {
+  std::ostringstream k;
+  k.precision(17);
+  k << config.N << ' ' << config.dt << ' ' << int(config.layout) << ' '
+    << int(config.integrator) << ' ' << config.terminal_cost << ' ' << int(config.solver)
+    << ' ' << int(config.formulation) << ' ' << config.relinearise_tolerance << ' '
+    << config.linearisation_table << ' ' << int(config.kkt_solver) << ' ' << config.kkt_tolerance
+    << ' ' << config.ipopt_options;
+  return k.str();
+}
+
+size_t ProblemStructure::size_bytes() const {
+  auto sparse = [](const Eigen::SparseMatrix<double>& m) {
+    return m.nonZeros() * (sizeof(double) + sizeof(int)) + (m.outerSize() + 1) * sizeof(int);
+  };
+  return sizeof(*this) + terminal.size() * sizeof(double) + sparse(cost_matrix) +
+         cost_target.size() * sizeof(double) + sparse(H) + q.size() * sizeof(double) +
+         hessian_blocks.size_bytes() + lm_jacobian.size() * sizeof(double) +
+         (table ? table->size_bytes() : 0) + ipopt_options.size() +
+         (vars_lowerbound.size() + vars_upperbound.size()) * sizeof(double);
+}
@@ -0,0 +1,87 @@
+#ifndef STRUCTURE_H
+#define STRUCTURE_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "Eigen-3.3/Eigen/Core"
+#include "Eigen-3.3/Eigen/SparseCore"
+#include "MPC.h"
+#include "kkt.h"
+#include "linearisation.h"
+#include "problem.h"
+
+/*
+ Everything about the optimisation problem that follows from the
+ configuration alone: the variable layout, the quadratic cost, the
+ terminal weight, the Jacobian table, the Ipopt options and bounds.
+
+ It is built once and never changes afterwards, so every controller with
+ the same configuration shares one instance (see get()), from any thread.
+ A controller only adds its own per-frame workspace: the previous
+ solution, multipliers and cached linearisations, a few KiB at N = 10
+ against the 3 MiB of a linearisation table.
+ */
+class ProblemStructure {
+ public:
+  explicit ProblemStructure(const MPCConfig& config);
+
+  // With the terminal weight and the table computed earlier, see
+  // structure_cache.h. Both must be what the constructor above would build.
+  ProblemStructure(const MPCConfig& config, const Eigen::MatrixXd& terminal,
+                   std::unique_ptr<LinearisationTable> table);
+
+  // The structure of config, shared with every controller that asked for
+  // an equal one and is still alive; built on the first request.
+  static std::shared_ptr<const ProblemStructure> get(const MPCConfig& config);
+
+  // The same, but the first request loads the structure from the cache in
+  // cache_directory, or builds it and writes the cache file. Without a
+  // linearisation table there is too little to gain, and with an empty
+  // cache_directory nothing to use: get(config) then.
+  static std::shared_ptr<const ProblemStructure> get(const MPCConfig& config,
+                                                     const std::string& cache_directory);
+
+  // Identifies a configuration: equal keys, equal structures. Leaves out
+  // MPCConfig::verbose, which only the controller uses.
+  static std::string key(const MPCConfig& config);
+
+  // Approximate heap memory held, for the benchmark.
+  size_t size_bytes() const;
+
+  const MPCConfig config;
+  const VarIndex idx;
+
+  // Terminal cost weight on [cte, epsi, v - ref_v]; empty when disabled.
+  Eigen::MatrixXd terminal;
+
+  // The cost as |cost_matrix * w - cost_target|^2 / 2, the form the
+  // Levenberg-Marquardt backend needs: every term w * e^2 becomes a row
+  // sqrt(2 w) * e.
+  Eigen::SparseMatrix<double> cost_matrix;
+  Eigen::VectorXd cost_target;
+
+  // The same cost as 0.5 * w'Hw + q'w + cost_offset, for RTI.
+  Eigen::SparseMatrix<double> H;
+  Eigen::VectorXd q;
+  double cost_offset;
+
+  // The stage blocks of H for the MINRES preconditioner.
+  StageHessian hessian_blocks;
+
+  // Levenberg-Marquardt only, otherwise empty: the entries of its
+  // residual Jacobian that are the same at every iteration, see lm.h.
+  Eigen::MatrixXd lm_jacobian;
+
+  // RTI with linearisation_table only, otherwise null.
+  std::unique_ptr<LinearisationTable> table;
+
+  // Ipopt only: where the variables of config.formulation sit, which is
+  // idx for the full problem, the options string and the variable bounds.
+  const VarIndex nlp_idx;
+  std::string ipopt_options;
+  std::vector<double> vars_lowerbound;
+  std::vector<double> vars_upperbound;
+};
+
+#endif /* STRUCTURE_H */
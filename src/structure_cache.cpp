@@ -0,0 +1,166 @@
+#include "structure_cache.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+namespace {
+
+const char magic[8] = {'M', 'P', 'C', 'S', 'T', 'R', 'U', 'C'};
+// Reads back differently on a host of the other byte order.
+const uint32_t byte_order = 0x01020304;
+const size_t alignment = 64;
+
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint64_t key_hash;
+  // The key follows the header, then the terminal weight (0 or 9 doubles,
+  // column-major).
+  uint64_t key_size;
+  uint64_t terminal_size;
+  // Grid of the table, all 0 without one, and where its values start.
+  uint64_t table_points[3];
+  uint64_t table_offset;
+  uint64_t file_size;
+};
+
+size_t aligned(size_t offset) { return (offset + alignment - 1) / alignment * alignment; }
+
+// The whole file mapped read-only, unmapped with the last reference.
+std::shared_ptr<const void> map_file(const std::string& path, size_t& size) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return nullptr;
+  }
+  void* p = MAP_FAILED;
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    size = st.st_size;
+    p = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (p == MAP_FAILED) {
+    return nullptr;
+  }
+  const size_t length = size;
+  return std::shared_ptr<const void>(
+      p, [length](const void* p) { munmap(const_cast<void*>(p), length); });
+}
+
+}  // namespace
+
+uint64_t config_hash(const MPCConfig& config) {
+  uint64_t h = 14695981039346656037ull;
+  for (char c : ProblemStructure::key(config)) {
+    h ^= static_cast<unsigned char>(c);
+    h *= 1099511628211ull;
+  }
+  return h;
+}
+
+std::string structure_cache_path(const std::string& directory, const MPCConfig& config) {
+  char name[64];
+  snprintf(name, sizeof(name), "mpc_structure_%016llx.bin",
+           static_cast<unsigned long long>(config_hash(config)));
+  return directory + "/" + name;
+}
+
+std::shared_ptr<const ProblemStructure> load_structure(const MPCConfig& config,
+                                                       const std::string& path) {
+  size_t size = 0;
+  std::shared_ptr<const void> file = map_file(path, size);
+  if (!file || size < sizeof(Header)) {
+    return nullptr;
+  }
+  const char* base = static_cast<const char*>(file.get());
+  Header header;
+  memcpy(&header, base, sizeof(header));
+
+  const std::string key = ProblemStructure::key(config);
+  const bool has_table = config.solver == Solver::RTI && config.linearisation_table;
+  if (memcmp(header.magic, magic, sizeof(magic)) != 0 ||
+      header.version != structure_cache_version || header.byte_order != byte_order ||
+      header.file_size != size || header.key_hash != config_hash(config) ||
+      header.key_size != key.size() || sizeof(Header) + key.size() > size ||
+      key.compare(0, key.size(), base + sizeof(Header), key.size()) != 0) {
+    return nullptr;
+  }
+  if (header.terminal_size != (config.terminal_cost ? 9u : 0u) ||
+      sizeof(Header) + key.size() + header.terminal_size * sizeof(double) > size ||
+      (header.table_points[0] > 0) != has_table) {
+    return nullptr;
+  }
+
+  Eigen::MatrixXd terminal;
+  if (config.terminal_cost) {
+    terminal.resize(3, 3);
+    memcpy(terminal.data(), base + sizeof(Header) + key.size(), 9 * sizeof(double));
+  }
+
+  std::unique_ptr<LinearisationTable> table;
+  if (has_table) {
+    if (header.table_offset % alignment != 0 || header.table_offset > size) {
+      return nullptr;
+    }
+    table.reset(new LinearisationTable(
+        header.table_points[0], header.table_points[1], header.table_points[2],
+        reinterpret_cast<const double*>(base + header.table_offset), file));
+    if (header.table_offset + table->size_bytes() > size) {
+      return nullptr;
+    }
+  }
+  return std::make_shared<const ProblemStructure>(config, terminal, std::move(table));
+}
+
+bool save_structure(const ProblemStructure& structure, const std::string& path) {
+  const std::string key = ProblemStructure::key(structure.config);
+  const LinearisationTable* table = structure.table.get();
+
+  Header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, magic, sizeof(magic));
+  header.version = structure_cache_version;
+  header.byte_order = byte_order;
+  header.key_hash = config_hash(structure.config);
+  header.key_size = key.size();
+  header.terminal_size = structure.terminal.size();
+  size_t end = sizeof(Header) + key.size() + header.terminal_size * sizeof(double);
+  if (table) {
+    header.table_points[0] = table->psi_points();
+    header.table_points[1] = table->v_points();
+    header.table_points[2] = table->delta_points();
+    header.table_offset = aligned(end);
+    end = header.table_offset + table->size_bytes();
+  }
+  header.file_size = end;
+  const size_t values_end = sizeof(Header) + key.size() + header.terminal_size * sizeof(double);
+
+  const std::string temporary = path + ".tmp" + std::to_string(getpid());
+  {
+    std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(key.data(), key.size());
+    out.write(reinterpret_cast<const char*>(structure.terminal.data()),
+              header.terminal_size * sizeof(double));
+    if (table) {
+      std::vector<char> padding(header.table_offset - values_end, 0);
+      out.write(padding.data(), padding.size());
+      out.write(reinterpret_cast<const char*>(table->values()), table->size_bytes());
+    }
+    if (!out) {
+      std::remove(temporary.c_str());
+      return false;
+    }
+  }
+  if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+    std::remove(temporary.c_str());
+    return false;
+  }
+  return true;
+}
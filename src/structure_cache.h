@@ -0,0 +1,49 @@
+#ifndef STRUCTURE_CACHE_H
+#define STRUCTURE_CACHE_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include "MPC.h"
+#include "structure.h"
+
+/*
+ On-disk cache of the parts of a ProblemStructure that are slow to build:
+ the LQR terminal weight and the linearisation table (about 3 MiB and
+ most of the start-up time with RTI). The rest of the structure is
+ rebuilt from the config, which takes microseconds.
+
+ One file per configuration, named after a hash of ProblemStructure::key.
+ The file holds a header, the full key, the terminal weight and the
+ table values. The values are 64-byte aligned so that the table reads them
+ straight from an mmap of the file. Processes using the same
+ configuration share those pages.
+
+ The format is the host's native layout. A file from another version,
+ byte order or configuration is ignored and then rewritten. Bump
+ structure_cache_version whenever the layout, the model or the cost
+ changes what is stored.
+
+ Ipopt records its CppAD tape, sparsity patterns and colourings inside
+ CppAD::ipopt::solve on every call and does not expose them, so there is
+ nothing of the Ipopt path to cache here.
+ */
+
+const uint32_t structure_cache_version = 1;
+
+// 64-bit FNV-1a of ProblemStructure::key.
+uint64_t config_hash(const MPCConfig& config);
+
+// directory/mpc_structure_<hash>.bin
+std::string structure_cache_path(const std::string& directory, const MPCConfig& config);
+
+// The structure of config from the file at path, or null when the file is
+// missing or does not match.
+std::shared_ptr<const ProblemStructure> load_structure(const MPCConfig& config,
+                                                       const std::string& path);
+
+// Write structure to path, through a temporary file so that a reader
+// never sees half of it. False on failure.
+bool save_structure(const ProblemStructure& structure, const std::string& path);
+
+#endif /* STRUCTURE_CACHE_H */
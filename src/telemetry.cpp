@@ -0,0 +1,283 @@
+#include "telemetry.h"
+#include <math.h>
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+#include "Eigen-3.3/Eigen/Core"
+#include "Eigen-3.3/Eigen/QR"
+#include "helpers.h"
+#include "json.hpp"
+#include "profiler.h"
+
+// for convenience
+using json = nlohmann::json;
+
+// For converting back and forth between radians and degrees.
+constexpr double pi() { return M_PI; }
+double deg2rad(double x) { return x * pi() / 180; }
+double rad2deg(double x) { return x * 180 / pi(); }
+
+// Checks if the SocketIO event has JSON data.
+// If there is data the JSON object in string format will be returned,
+// else the empty string "" will be returned.
+string hasData(string s) {
+  auto found_null = s.find("null");
+  auto b1 = s.find_first_of("[");
+  auto b2 = s.rfind("}]");
+  if (found_null != string::npos) {
+    return "";
+  } else if (b1 != string::npos && b2 != string::npos) {
+    return s.substr(b1, b2 - b1 + 2);
+  }
+  return "";
+}
+
+// data[key] as a finite number; throws std::invalid_argument otherwise.
+static double number(const json &data, const char *key) {
+  auto v = data.find(key);
+  if (v == data.end() || !v->is_number() || !std::isfinite(v->get<double>())) {
+    throw std::invalid_argument(std::string(key) + " is not a number");
+  }
+  return v->get<double>();
+}
+
+// data[key] as an array of finite numbers; throws std::invalid_argument
+// otherwise.
+static vector<double> numbers(const json &data, const char *key) {
+  auto v = data.find(key);
+  if (v == data.end() || !v->is_array()) {
+    throw std::invalid_argument(std::string(key) + " is not an array");
+  }
+  vector<double> values;
+  for (const json &x : *v) {
+    if (!x.is_number() || !std::isfinite(x.get<double>())) {
+      throw std::invalid_argument(std::string(key) + " holds something other than a number");
+    }
+    values.push_back(x.get<double>());
+  }
+  return values;
+}
+
+// Solve for one vehicle's telemetry, data, and build its steering reply,
+// with the predicted trajectory and the reference line for display or
+// without.
+static json drive(const json &data, MPC &mpc, const MPCConfig &config, bool display) {
+  StageScope fit(Stage::FIT);
+  if (!data.is_object()) {
+    throw std::invalid_argument("telemetry is not an object");
+  }
+  vector<double> ptsx = numbers(data, "ptsx");
+  vector<double> ptsy = numbers(data, "ptsy");
+  // The third order fit needs 4 points.
+  if (ptsx.size() != ptsy.size() || ptsx.size() < 4) {
+    throw std::invalid_argument("ptsx and ptsy need the same number of points, at least 4");
+  }
+  double px = number(data, "x");
+  double py = number(data, "y");
+  double psi = number(data, "psi");
+  double v = number(data, "speed");
+  double delta = number(data, "steering_angle");
+  double acceleration = number(data, "throttle");
+
+  v = v * 0.44704; // convert to m/s from mph
+  delta = -delta; // convert steering angle delta sign from simulator
+
+  // predict state in 100ms using kinematic model, integrated the
+  // same way as the solver's model constraints
+  double latency = actuation_latency;
+  VehicleState<double> predicted =
+      step(VehicleState<double>{px, py, psi, v}, delta, acceleration, latency, config.integrator);
+  px = predicted.x;
+  py = predicted.y;
+  psi = predicted.psi;
+  v = predicted.v;
+
+  Eigen::VectorXd way_pts_x(ptsx.size());
+  Eigen::VectorXd way_pts_y(ptsx.size());
+
+  // Tranform waypoints to car co-ordinates. 
+  // Remainder of the calculations are done in car co-ordinate system
+  for(size_t i=0; i < ptsx.size(); i++) {
+    auto coord_car = global2car(psi, px, py, ptsx[i], ptsy[i]);
+    way_pts_x(i) = coord_car[0];
+    way_pts_y(i) = coord_car[1];
+  }
+
+  // Fit a third order polynomial to way points to
+  // model the reference trajectory
+  auto coeffs = polyfit(way_pts_x, way_pts_y, 3);
+
+  // Since we are in the car co-ordinate system the cross track error
+  // is simply the y co-ordinate of the reference trajectory at x = 0
+  double cte = polyeval(coeffs,0);
+  // For the same reason error in yaw angle is the direction of the
+  // reference trajectory at x = 0. i.e. arctangent of the derivative
+  // of the reference trajectory
+  double epsi = -atan(coeffs[1]);
+
+
+  /*
+  State variables 
+     x and y positions of car
+     yaw angle
+     speed in heading direction
+     cross track error
+     yaw angle error
+
+  Since we are in car-cordinate system the cars position (x,y) and yaw angle (psi) are all 0.
+  Since car-cordinate system has the same scale as the global system v does not change
+  */
+  Eigen::VectorXd state(6);
+  state << 0, 0, 0, v, cte, epsi;
+
+  /*
+  * Calculate steering angle and throttle using MPC.
+  * Both are in between [-1, 1].
+  *
+  */
+  auto result = mpc.Solve(state, coeffs);
+  StageScope serialise(Stage::SERIALISE);
+
+  // Apply the first actuation values from the solver to the car
+  double steer_value = -result[0];
+  double throttle_value = result[1];
+
+  json msgJson;
+  // NOTE: Remember to divide by deg2rad(25) before you send the steering value back.
+  // Otherwise the values will be in between [-deg2rad(25), deg2rad(25] instead of [-1, 1].
+  msgJson["steering_angle"] = steer_value/deg2rad(25);
+  msgJson["throttle"] = throttle_value;
+  if (!display) {
+    return msgJson;
+  }
+
+  //Display the MPC predicted trajectory 
+  vector<double> mpc_x_vals;
+  vector<double> mpc_y_vals;
+
+  //.. add (x,y) points to list here, points are in reference to the vehicle's coordinate system
+  // the points in the simulator are connected by a Green line
+  size_t n = (result.size()-2)/2;
+  for (size_t i = 0; i < n; i ++) {
+      mpc_x_vals.push_back(result[i + 2]);
+      mpc_y_vals.push_back(result[i + n + 2]);
+  }
+
+  msgJson["mpc_x"] = mpc_x_vals;
+  msgJson["mpc_y"] = mpc_y_vals;
+
+  //Display the waypoints/reference line
+  vector<double> next_x_vals;
+  vector<double> next_y_vals;
+
+  //.. add (x,y) points to list here, points are in reference to the vehicle's coordinate system
+  // the points in the simulator are connected by a Yellow line
+  for (int i = 0; i < way_pts_x.size(); i += 1){
+    //next_x_vals.push_back(way_pts_x(i));
+    //next_y_vals.push_back(way_pts_y(i));
+  }
+
+  for (double i = 0; i < 100.0; i += 2){
+    next_x_vals.push_back(i);
+    next_y_vals.push_back(polyeval(coeffs, i));
+  }
+
+  msgJson["next_x"] = next_x_vals;
+  msgJson["next_y"] = next_y_vals;
+  return msgJson;
+}
+
+// Solve for every record of a fleet frame, see telemetry.h.
+static json drive_fleet(const json &vehicles, Fleet &fleet, const MPCConfig &config,
+                        WorkerThreads &workers) {
+  const size_t n = vehicles.is_array() ? vehicles.size() : 0;
+  std::vector<json> records(n);
+  std::vector<MPC *> controllers(n, nullptr);
+
+  // The controllers come from the pool, so they are handed out here on the
+  // event loop thread, before the solves.
+  fleet.begin_frame();
+  for (size_t i = 0; i < n; i++) {
+    auto id = vehicles[i].find("id");
+    if (id == vehicles[i].end()) {
+      records[i]["error"] = "no id";
+      continue;
+    }
+    records[i]["id"] = *id;
+    controllers[i] = fleet.controller(id->dump());
+    if (!controllers[i]) {
+      records[i]["error"] = fleet.contains(id->dump()) ? "repeated id" : "no controller free";
+    }
+  }
+  fleet.release_absent();
+
+  auto solve = [&](size_t i) {
+    if (!controllers[i]) {
+      return;
+    }
+    try {
+      json steer = drive(vehicles[i], *controllers[i], config, false);
+      records[i]["steering_angle"] = steer["steering_angle"];
+      records[i]["throttle"] = steer["throttle"];
+    } catch (const std::exception &e) {
+      records[i]["error"] = e.what();
+    }
+  };
+  if (config.solver == Solver::IPOPT) {
+    // Neither Ipopt nor CppAD's taping is thread-safe. The other solvers
+    // share nothing between controllers but the read-only structure.
+    for (size_t i = 0; i < n; i++) {
+      solve(i);
+    }
+  } else {
+    workers.run(n, solve);
+  }
+
+  StageScope serialise(Stage::SERIALISE);
+  json reply;
+  reply["vehicles"] = records;
+  return reply;
+}
+
+TelemetryReply handle_message(const std::string &sdata, Fleet &fleet, const MPCConfig &config,
+                              WorkerThreads &workers) {
+  TelemetryReply reply;
+  // "42" at the start of the message means there's a websocket message event.
+  // The 4 signifies a websocket message
+  // The 2 signifies a websocket event
+  if (sdata.size() > 2 && sdata[0] == '4' && sdata[1] == '2') {
+    StageScope parse(Stage::PARSE);
+    string s = hasData(sdata);
+    if (s != "") {
+      // A malformed frame gets an error event back rather than taking down
+      // the server.
+      try {
+        auto j = json::parse(s);
+        string event = j[0].get<string>();
+        if (event == "telemetry") {
+          // j[1] is the data JSON object
+          fleet.begin_frame();
+          // The car's controller, taken when the connection came in.
+          json msgJson = drive(j[1], *fleet.controller(""), config, true);
+          StageScope serialise(Stage::SERIALISE);
+          reply.message = "42[\"steer\"," + msgJson.dump() + "]";
+          reply.delayed = true;
+        } else if (event == "fleet") {
+          json msgJson = drive_fleet(j[1]["vehicles"], fleet, config, workers);
+          StageScope serialise(Stage::SERIALISE);
+          reply.message = "42[\"fleet_steer\"," + msgJson.dump() + "]";
+          reply.delayed = true;
+        }
+      } catch (const std::exception &e) {
+        std::cerr << "Malformed frame: " << e.what() << std::endl;
+        reply.message = "42[\"error\"," + json{{"message", e.what()}}.dump() + "]";
+        reply.delayed = false;
+      }
+    } else {
+      // Manual driving
+      reply.message = "42[\"manual\",{}]";
+    }
+  }
+  return reply;
+}
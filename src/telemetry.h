@@ -0,0 +1,44 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <string>
+#include "MPC.h"
+#include "fleet.h"
+
+// Actuation latency of the car in seconds. The state is predicted this far
+// ahead, and the servers hold steering replies back for this long.
+const double actuation_latency = 0.1;
+
+struct TelemetryReply {
+  // The Socket.IO message to send back, or empty.
+  std::string message;
+  // A steering reply, to be held back by the actuation latency.
+  bool delayed = false;
+};
+
+// The controller pipeline shared by the servers (main.cpp and
+// uring_server.cpp): parse one Socket.IO message from the simulator, solve
+// with the connection's controllers and build the reply.
+//
+// A "telemetry" event is one vehicle, answered with "steer". A "fleet"
+// event carries many vehicles keyed by id (see fleet.h), solved on workers
+// and answered with one "fleet_steer" event:
+//
+//   42["fleet",{"vehicles":[{"id":"a","ptsx":[...],"ptsy":[...],"x":..,
+//       "y":..,"psi":..,"speed":..,"steering_angle":..,"throttle":..},...]}]
+//   42["fleet_steer",{"vehicles":[{"id":"a","steering_angle":..,
+//       "throttle":..},...]}]
+//
+// The records of the reply are in the order of the request. They leave out
+// the predicted trajectory and the reference line, which are for the
+// simulator's display. A record that cannot be solved, e.g. for a missing
+// field, fewer than 4 waypoints, a field that is not a number, an id that
+// is already in the frame or a full pool, has an "error" instead. A frame
+// that is not valid JSON, or not an event of this shape, is answered at
+// once with
+//
+//   42["error",{"message":"..."}]
+TelemetryReply handle_message(const std::string &sdata, Fleet &fleet, const MPCConfig &config,
+                              WorkerThreads &workers);
+
+#endif /* TELEMETRY_H */
@@ -0,0 +1,566 @@
+#include <liburing.h>
+#include <netinet/in.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "MPC.h"
+#include "fleet.h"
+#include "pool.h"
+#include "profiler.h"
+#include "structure.h"
+#include "telemetry.h"
+#include "websocket.h"
+
+/*
+ WebSocket server on io_uring, an alternative to the uWS server in
+ main.cpp for many connections. It runs the same pipeline (telemetry.h)
+ with controllers from the same pool, and solves the vehicles of a fleet
+ frame on the same worker threads.
+
+ - One multishot accept on the listening socket.
+ - One multishot receive per connection, into a ring of buffers provided
+   to the kernel up front: no receive buffer per connection and no
+   request per read.
+ - Replies go out with write_fixed from a registered send buffer per
+   connection slot. The kernel pins those, so when RLIMIT_MEMLOCK is too
+   small for them (1024 slots take 16 MiB) they go out with plain sends
+   from the same memory instead.
+ - Messages are handled, and so solved, on a solver thread, one at a time
+   in the order they came in. A slow solve then holds up the replies
+   queued behind it, but not the accepts, receives and sends of the ring
+   thread. Finished replies come back through an eventfd read by the
+   ring.
+ - Steering replies are held back by a timeout request instead of a
+   sleep, so the actuation latency of one vehicle does not stall the
+   others.
+ - All completions of a batch are handled before the next
+   io_uring_submit_and_wait, which submits every request they produced
+   and waits for more in one system call.
+
+ Usage: mpc_uring [--port p] [--latency-ms ms] [--max-connections n]
+                  [--controllers n] [--solver ipopt|rti|lm] [--threads n]
+                  [--profile-hz hz] [--linearisation-table]
+                  [--structure-cache dir]
+ */
+
+namespace {
+
+// Kind of request, in the upper half of its user data; the lower half is
+// the connection slot.
+enum Op : uint64_t { ACCEPT, RECV, WRITE, TIMEOUT, CLOSE, SOLVED };
+
+const unsigned ring_entries = 4096;
+const unsigned recv_buffers = 1024;  // a power of two
+const size_t recv_buffer_size = 4096;
+const size_t send_buffer_size = 16384;
+const int buffer_group = 0;
+
+// An upgrade request larger than this is refused.
+const size_t max_request_size = 8192;
+
+struct Connection {
+  int fd = -1;
+  bool upgraded = false;
+  // Close once the output is written and no request is in flight.
+  bool closing = false;
+  // The controllers of the connection's vehicles, once upgraded.
+  Fleet* fleet = nullptr;
+
+  std::string input;
+  std::string output;
+  bool writing = false;
+
+  // Steering replies waiting for their timeout, oldest first.
+  struct Delayed {
+    std::string frame;
+    __kernel_timespec ts;
+  };
+  std::deque<Delayed> delayed;
+
+  // Requests in flight that refer to this slot, including messages on
+  // the solver thread.
+  int pending = 0;
+};
+
+class UringServer {
+ public:
+  UringServer(ControllerPool& pool, WorkerThreads& workers, const MPCConfig& config,
+              size_t max_connections, int latency_ms)
+      : pool(pool),
+        workers(workers),
+        config(config),
+        connections(max_connections),
+        latency_ms(latency_ms) {}
+
+  ~UringServer() {
+    {
+      std::lock_guard<std::mutex> lock(solve_mutex);
+      stopping = true;
+    }
+    solve_wake.notify_all();
+    if (solver.joinable()) {
+      solver.join();
+    }
+  }
+
+  bool listen(int port) {
+    int ret = io_uring_queue_init(ring_entries, &ring, 0);
+    if (ret < 0) {
+      std::cerr << "io_uring_queue_init: " << strerror(-ret) << std::endl;
+      return false;
+    }
+
+    // Receive buffers, handed to the kernel once and recycled.
+    recv_memory.resize(recv_buffers * recv_buffer_size);
+    buffers = io_uring_setup_buf_ring(&ring, recv_buffers, buffer_group, 0, &ret);
+    if (!buffers) {
+      std::cerr << "io_uring_setup_buf_ring: " << strerror(-ret) << std::endl;
+      return false;
+    }
+    for (unsigned i = 0; i < recv_buffers; i++) {
+      recycle(i, i);
+    }
+    io_uring_buf_ring_advance(buffers, recv_buffers);
+
+    // One send buffer per connection slot, registered if the kernel lets
+    // us pin that much.
+    send_memory.resize(connections.size() * send_buffer_size);
+    std::vector<iovec> iovecs(connections.size());
+    for (size_t i = 0; i < connections.size(); i++) {
+      iovecs[i].iov_base = &send_memory[i * send_buffer_size];
+      iovecs[i].iov_len = send_buffer_size;
+      available.push_back(connections.size() - 1 - i);
+    }
+    rlimit memlock;
+    if (getrlimit(RLIMIT_MEMLOCK, &memlock) == 0 && memlock.rlim_cur != RLIM_INFINITY &&
+        memlock.rlim_cur < send_memory.size()) {
+      std::cerr << "RLIMIT_MEMLOCK is " << memlock.rlim_cur / 1024 << " KiB, less than the "
+                << send_memory.size() / 1024 << " KiB of send buffers; not registering them"
+                << std::endl;
+    } else {
+      ret = io_uring_register_buffers(&ring, iovecs.data(), iovecs.size());
+      fixed_buffers = ret == 0;
+      if (ret < 0) {
+        std::cerr << "io_uring_register_buffers: " << strerror(-ret)
+                  << "; not registering the send buffers" << std::endl;
+      }
+    }
+
+    solved_fd = eventfd(0, EFD_CLOEXEC);
+    if (solved_fd < 0) {
+      std::cerr << "eventfd: " << strerror(errno) << std::endl;
+      return false;
+    }
+    solver = std::thread(&UringServer::solve_messages, this);
+    wait_for_solved();
+
+    listener = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+    if (listener < 0 || bind(listener, (sockaddr*)&address, sizeof(address)) != 0 ||
+        ::listen(listener, 512) != 0) {
+      return false;
+    }
+    accept();
+    return true;
+  }
+
+  void run() {
+    for (;;) {
+      int ret = io_uring_submit_and_wait(&ring, 1);
+      if (ret < 0 && ret != -EINTR) {
+        std::cerr << "io_uring_submit_and_wait: " << strerror(-ret) << std::endl;
+        return;
+      }
+      unsigned head;
+      unsigned count = 0;
+      io_uring_cqe* cqe;
+      io_uring_for_each_cqe(&ring, head, cqe) {
+        complete(cqe);
+        count++;
+      }
+      io_uring_cq_advance(&ring, count);
+    }
+  }
+
+ private:
+  ControllerPool& pool;
+  WorkerThreads& workers;
+  const MPCConfig& config;
+  std::vector<Connection> connections;
+  std::vector<uint32_t> available;
+  int latency_ms;
+
+  io_uring ring;
+  int listener = -1;
+  io_uring_buf_ring* buffers = nullptr;
+  std::vector<char> recv_memory;
+  std::vector<char> send_memory;
+  // send_memory is registered with the ring, for write_fixed.
+  bool fixed_buffers = false;
+
+  // A message for the solver thread, and its reply.
+  struct Message {
+    uint32_t slot;
+    Fleet* fleet;
+    std::string text;
+  };
+  struct Solved {
+    uint32_t slot;
+    TelemetryReply reply;
+  };
+  std::thread solver;
+  // Guards messages, solved and stopping.
+  std::mutex solve_mutex;
+  std::condition_variable solve_wake;
+  std::deque<Message> messages;
+  std::deque<Solved> solved;
+  bool stopping = false;
+  // Counts the replies in solved; read by a request on the ring.
+  int solved_fd = -1;
+  uint64_t solved_count = 0;
+
+  // A submission entry, submitting the queue first when it is full.
+  io_uring_sqe* sqe(Op op, uint32_t slot) {
+    io_uring_sqe* e = io_uring_get_sqe(&ring);
+    if (!e) {
+      io_uring_submit(&ring);
+      e = io_uring_get_sqe(&ring);
+    }
+    io_uring_sqe_set_data64(e, uint64_t(op) << 32 | slot);
+    if (op != ACCEPT && op != SOLVED) {
+      connections[slot].pending++;
+    }
+    return e;
+  }
+
+  void recycle(unsigned bid, int offset) {
+    io_uring_buf_ring_add(buffers, &recv_memory[bid * recv_buffer_size], recv_buffer_size, bid,
+                          io_uring_buf_ring_mask(recv_buffers), offset);
+  }
+
+  void accept() { io_uring_prep_multishot_accept(sqe(ACCEPT, 0), listener, nullptr, nullptr, 0); }
+
+  void wait_for_solved() {
+    io_uring_prep_read(sqe(SOLVED, 0), solved_fd, &solved_count, sizeof(solved_count), 0);
+  }
+
+  // The solver thread: handle_message() for every message, in order.
+  void solve_messages() {
+    for (;;) {
+      Message message;
+      {
+        std::unique_lock<std::mutex> lock(solve_mutex);
+        solve_wake.wait(lock, [&] { return stopping || !messages.empty(); });
+        if (stopping) {
+          return;
+        }
+        message = std::move(messages.front());
+        messages.pop_front();
+      }
+      TelemetryReply reply = handle_message(message.text, *message.fleet, config, workers);
+      {
+        std::lock_guard<std::mutex> lock(solve_mutex);
+        solved.push_back(Solved{message.slot, std::move(reply)});
+      }
+      const uint64_t one = 1;
+      if (write(solved_fd, &one, sizeof(one)) != sizeof(one)) {
+        std::cerr << "eventfd write: " << strerror(errno) << std::endl;
+      }
+    }
+  }
+
+  void receive(uint32_t slot) {
+    io_uring_sqe* e = sqe(RECV, slot);
+    io_uring_prep_recv_multishot(e, connections[slot].fd, nullptr, 0, 0);
+    e->flags |= IOSQE_BUFFER_SELECT;
+    e->buf_group = buffer_group;
+  }
+
+  void complete(io_uring_cqe* cqe) {
+    const uint64_t data = io_uring_cqe_get_data64(cqe);
+    const Op op = static_cast<Op>(data >> 32);
+    const uint32_t slot = static_cast<uint32_t>(data);
+    const bool more = cqe->flags & IORING_CQE_F_MORE;
+
+    if (op == ACCEPT) {
+      if (cqe->res >= 0) {
+        opened(cqe->res);
+      }
+      if (!more) {
+        accept();
+      }
+      return;
+    }
+    if (op == SOLVED) {
+      std::deque<Solved> replies;
+      {
+        std::lock_guard<std::mutex> lock(solve_mutex);
+        replies.swap(solved);
+      }
+      for (const Solved& s : replies) {
+        Connection& c = connections[s.slot];
+        c.pending--;
+        if (!c.closing) {
+          reply(s.slot, s.reply);
+        }
+        flush(s.slot);
+      }
+      wait_for_solved();
+      return;
+    }
+
+    Connection& c = connections[slot];
+    if (!more) {
+      c.pending--;
+    }
+    switch (op) {
+      case RECV:
+        if (cqe->flags & IORING_CQE_F_BUFFER) {
+          unsigned bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+          if (cqe->res > 0 && !c.closing) {
+            c.input.append(&recv_memory[bid * recv_buffer_size], cqe->res);
+          }
+          recycle(bid, 0);
+          io_uring_buf_ring_advance(buffers, 1);
+        }
+        if (cqe->res > 0) {
+          process(slot);
+          if (!more && !c.closing) {
+            receive(slot);
+          }
+        } else if (cqe->res == -ENOBUFS && !c.closing) {
+          receive(slot);
+        } else if (!more) {
+          // Closed by the peer, or failed.
+          c.closing = true;
+          c.output.clear();
+        }
+        break;
+      case WRITE:
+        c.writing = false;
+        if (cqe->res > 0) {
+          c.output.erase(0, cqe->res);
+        } else {
+          c.closing = true;
+          c.output.clear();
+        }
+        break;
+      case TIMEOUT:
+        if (!c.delayed.empty()) {
+          if (!c.closing) {
+            c.output += c.delayed.front().frame;
+          }
+          c.delayed.pop_front();
+        }
+        break;
+      case CLOSE:
+        c = Connection();
+        available.push_back(slot);
+        return;
+      default:
+        break;
+    }
+    flush(slot);
+  }
+
+  void opened(int fd) {
+    if (available.empty()) {
+      close(fd);
+      return;
+    }
+    uint32_t slot = available.back();
+    available.pop_back();
+    connections[slot].fd = fd;
+    receive(slot);
+  }
+
+  // Handle every complete request or frame in the input.
+  void process(uint32_t slot) {
+    Connection& c = connections[slot];
+    size_t used = 0;
+    while (!c.closing) {
+      const char* data = c.input.data() + used;
+      const size_t size = c.input.size() - used;
+      if (!c.upgraded) {
+        size_t request_size = http_request_size(data, size);
+        if (request_size == 0) {
+          c.closing = size > max_request_size;
+          break;
+        }
+        std::string response;
+        if (websocket_accept(std::string(data, request_size), response)) {
+          c.upgraded = true;
+          c.fleet = pool.connect();
+          if (!c.fleet) {
+            response += close_frame(WebSocketError::TRY_AGAIN_LATER);
+            c.closing = true;
+          }
+        } else {
+          // Only the profile (see profiler.h); anything else is answered
+          // like the uWS server does.
+          const bool profile = std::string(data, std::min<size_t>(size, 13)) == "GET /profile ";
+          const std::string body = profile ? folded_profile() : "<h1>Hello world!</h1>";
+          response = "HTTP/1.1 200 OK\r\nContent-Length: " + std::to_string(body.size()) +
+                     "\r\nConnection: close\r\n\r\n" + body;
+          c.closing = true;
+        }
+        c.output += response;
+        used += request_size;
+        continue;
+      }
+
+      WebSocketFrame frame;
+      WebSocketError error;
+      size_t frame_size = decode_frame(data, size, frame, true, error);
+      if (error != WebSocketError::NONE) {
+        c.output += close_frame(error);
+        c.closing = true;
+        break;
+      }
+      if (frame_size == 0) {
+        break;
+      }
+      used += frame_size;
+      if (!frame.final || frame.opcode == WebSocketOpcode::CONTINUATION) {
+        // Fragmented messages are not supported.
+        c.output += encode_frame(WebSocketOpcode::CLOSE, "\x03\xf3");
+        c.closing = true;
+      } else if (frame.opcode == WebSocketOpcode::TEXT) {
+        // In flight until its reply comes back from the solver thread.
+        c.pending++;
+        std::lock_guard<std::mutex> lock(solve_mutex);
+        messages.push_back(Message{slot, c.fleet, std::move(frame.payload)});
+        solve_wake.notify_one();
+      } else if (frame.opcode == WebSocketOpcode::PING) {
+        c.output += encode_frame(WebSocketOpcode::PONG, frame.payload);
+      } else if (frame.opcode == WebSocketOpcode::CLOSE) {
+        c.output += encode_frame(WebSocketOpcode::CLOSE, frame.payload.substr(0, 2));
+        c.closing = true;
+      }
+    }
+    c.input.erase(0, used);
+  }
+
+  void reply(uint32_t slot, const TelemetryReply& reply) {
+    Connection& c = connections[slot];
+    if (reply.message.empty()) {
+      return;
+    }
+    std::string frame = encode_frame(WebSocketOpcode::TEXT, reply.message);
+    if (!reply.delayed || latency_ms <= 0) {
+      c.output += frame;
+      return;
+    }
+    c.delayed.push_back(Connection::Delayed{frame, {latency_ms / 1000, (latency_ms % 1000) * 1000000ll}});
+    io_uring_prep_timeout(sqe(TIMEOUT, slot), &c.delayed.back().ts, 0, 0);
+  }
+
+  // Start writing the output if nothing is being written, or close the
+  // connection once it is done with.
+  void flush(uint32_t slot) {
+    Connection& c = connections[slot];
+    if (c.writing || c.fd < 0) {
+      return;
+    }
+    if (!c.output.empty()) {
+      size_t size = std::min(c.output.size(), send_buffer_size);
+      char* buffer = &send_memory[slot * send_buffer_size];
+      memcpy(buffer, c.output.data(), size);
+      if (fixed_buffers) {
+        io_uring_prep_write_fixed(sqe(WRITE, slot), c.fd, buffer, size, 0, slot);
+      } else {
+        io_uring_prep_send(sqe(WRITE, slot), c.fd, buffer, size, 0);
+      }
+      c.writing = true;
+    } else if (c.closing) {
+      if (c.pending == 0) {
+        pool.disconnect(c.fleet);
+        c.fleet = nullptr;
+        io_uring_prep_close(sqe(CLOSE, slot), c.fd);
+        c.fd = -1;
+      } else if (c.delayed.empty()) {
+        // Ends the multishot receive, whose completion comes back here.
+        shutdown(c.fd, SHUT_RDWR);
+      }
+    }
+  }
+};
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  int port = 4567;
+  int latency_ms = static_cast<int>(actuation_latency * 1000);
+  size_t max_connections = 1024;
+  size_t controllers = 256;
+  MPCConfig config;
+  config.verbose = false;
+  size_t threads = 0;
+  double profile_hz = 0;
+  std::string structure_cache;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--port") && i + 1 < argc) {
+      port = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--latency-ms") && i + 1 < argc) {
+      latency_ms = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--max-connections") && i + 1 < argc) {
+      max_connections = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--controllers") && i + 1 < argc) {
+      controllers = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--solver") && i + 1 < argc && parse_solver(argv[i + 1], config.solver)) {
+      i++;
+    } else if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+      threads = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--profile-hz") && i + 1 < argc) {
+      profile_hz = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--linearisation-table")) {
+      config.linearisation_table = true;
+    } else if (!strcmp(argv[i], "--structure-cache") && i + 1 < argc) {
+      structure_cache = argv[++i];
+    } else {
+      std::cerr << "Usage: " << argv[0] << " [--port p] [--latency-ms ms] [--max-connections n]"
+                << " [--controllers n] [--solver ipopt|rti|lm] [--threads n] [--profile-hz hz]"
+                << " [--linearisation-table] [--structure-cache dir]" << std::endl;
+      return -1;
+    }
+  }
+
+  // Writes to a connection the peer has closed fail instead.
+  signal(SIGPIPE, SIG_IGN);
+
+  auto structure = ProblemStructure::get(config, structure_cache);
+  ControllerPool pool(structure, controllers);
+  WorkerThreads workers(threads);
+
+  if (profile_hz > 0 && !start_profiler(profile_hz)) {
+    std::cerr << "Could not start the profiler" << std::endl;
+  }
+
+  UringServer server(pool, workers, config, max_connections, latency_ms);
+  if (server.listen(port)) {
+    std::cout << "Listening to port " << port << std::endl;
+  } else {
+    std::cerr << "Failed to listen to port" << std::endl;
+    return -1;
+  }
+  server.run();
+}
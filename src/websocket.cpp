@@ -0,0 +1,234 @@
+#include "websocket.h"
+#include <strings.h>
+#include <cstring>
+#include <random>
+
+namespace {
+
+const char* const websocket_guid = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+uint32_t rotate(uint32_t x, int n) { return (x << n) | (x >> (32 - n)); }
+
+void sha1(const std::string& data, uint8_t digest[20]) {
+  uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+
+  // Message, 0x80, zeros, then the length in bits, to a multiple of 64.
+  std::string m = data;
+  m += '\x80';
+  while (m.size() % 64 != 56) {
+    m += '\0';
+  }
+  uint64_t bits = uint64_t(data.size()) * 8;
+  for (int i = 7; i >= 0; i--) {
+    m += static_cast<char>(bits >> (8 * i));
+  }
+
+  for (size_t block = 0; block < m.size(); block += 64) {
+    uint32_t w[80];
+    for (int i = 0; i < 16; i++) {
+      const uint8_t* p = reinterpret_cast<const uint8_t*>(&m[block + 4 * i]);
+      w[i] = uint32_t(p[0]) << 24 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 8 | p[3];
+    }
+    for (int i = 16; i < 80; i++) {
+      w[i] = rotate(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for (int i = 0; i < 80; i++) {
+      uint32_t f, k;
+      if (i < 20) {
+        f = (b & c) | (~b & d);
+        k = 0x5A827999;
+      } else if (i < 40) {
+        f = b ^ c ^ d;
+        k = 0x6ED9EBA1;
+      } else if (i < 60) {
+        f = (b & c) | (b & d) | (c & d);
+        k = 0x8F1BBCDC;
+      } else {
+        f = b ^ c ^ d;
+        k = 0xCA62C1D6;
+      }
+      uint32_t t = rotate(a, 5) + f + e + k + w[i];
+      e = d;
+      d = c;
+      c = rotate(b, 30);
+      b = a;
+      a = t;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+  }
+  for (int i = 0; i < 20; i++) {
+    digest[i] = static_cast<uint8_t>(h[i / 4] >> (24 - 8 * (i % 4)));
+  }
+}
+
+std::string base64(const uint8_t* data, size_t size) {
+  static const char* digits = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string out;
+  for (size_t i = 0; i < size; i += 3) {
+    uint32_t n = uint32_t(data[i]) << 16;
+    if (i + 1 < size) n |= uint32_t(data[i + 1]) << 8;
+    if (i + 2 < size) n |= data[i + 2];
+    out += digits[(n >> 18) & 63];
+    out += digits[(n >> 12) & 63];
+    out += i + 1 < size ? digits[(n >> 6) & 63] : '=';
+    out += i + 2 < size ? digits[n & 63] : '=';
+  }
+  return out;
+}
+
+// Value of header name (case-insensitive) in an HTTP message, or "".
+std::string header(const std::string& message, const std::string& name) {
+  size_t line = message.find("\r\n");
+  while (line != std::string::npos && line + 2 < message.size()) {
+    size_t start = line + 2;
+    size_t end = message.find("\r\n", start);
+    if (end == std::string::npos || end == start) {
+      break;
+    }
+    size_t colon = message.find(':', start);
+    if (colon < end && colon - start == name.size() &&
+        strncasecmp(&message[start], name.data(), name.size()) == 0) {
+      size_t value = message.find_first_not_of(' ', colon + 1);
+      return message.substr(value, end - value);
+    }
+    line = end;
+  }
+  return "";
+}
+
+}  // namespace
+
+std::string sha1_base64(const std::string& data) {
+  uint8_t digest[20];
+  sha1(data, digest);
+  return base64(digest, sizeof(digest));
+}
+
+size_t http_request_size(const char* data, size_t size) {
+  for (size_t i = 3; i < size; i++) {
+    if (data[i - 3] == '\r' && data[i - 2] == '\n' && data[i - 1] == '\r' && data[i] == '\n') {
+      return i + 1;
+    }
+  }
+  return 0;
+}
+
+bool websocket_accept(const std::string& request, std::string& response) {
+  std::string key = header(request, "Sec-WebSocket-Key");
+  if (key.empty()) {
+    return false;
+  }
+  response = "HTTP/1.1 101 Switching Protocols\r\n"
+             "Upgrade: websocket\r\n"
+             "Connection: Upgrade\r\n"
+             "Sec-WebSocket-Accept: " + sha1_base64(key + websocket_guid) + "\r\n\r\n";
+  return true;
+}
+
+std::string websocket_request(const std::string& host, const std::string& path,
+                              const std::string& key) {
+  return "GET " + path + " HTTP/1.1\r\n"
+         "Host: " + host + "\r\n"
+         "Upgrade: websocket\r\n"
+         "Connection: Upgrade\r\n"
+         "Sec-WebSocket-Key: " + key + "\r\n"
+         "Sec-WebSocket-Version: 13\r\n\r\n";
+}
+
+bool websocket_accepted(const std::string& response, const std::string& key) {
+  return response.compare(0, 12, "HTTP/1.1 101") == 0 &&
+         header(response, "Sec-WebSocket-Accept") == sha1_base64(key + websocket_guid);
+}
+
+size_t decode_frame(const char* data, size_t size, WebSocketFrame& frame, bool from_client,
+                    WebSocketError& error, size_t max_payload) {
+  error = WebSocketError::NONE;
+  if (size < 2) {
+    return 0;
+  }
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+  bool masked = p[1] & 0x80;
+  if (masked != from_client) {
+    error = WebSocketError::PROTOCOL;
+    return 0;
+  }
+  uint64_t length = p[1] & 0x7F;
+  size_t offset = 2;
+  if (length == 126 || length == 127) {
+    size_t bytes = length == 126 ? 2 : 8;
+    if (size < offset + bytes) {
+      return 0;
+    }
+    length = 0;
+    for (size_t i = 0; i < bytes; i++) {
+      length = length << 8 | p[offset + i];
+    }
+    offset += bytes;
+  }
+  if (length > max_payload) {
+    error = WebSocketError::TOO_BIG;
+    return 0;
+  }
+  uint8_t mask[4] = {0, 0, 0, 0};
+  if (masked) {
+    if (size < offset + 4) {
+      return 0;
+    }
+    memcpy(mask, p + offset, 4);
+    offset += 4;
+  }
+  if (size - offset < length) {
+    return 0;
+  }
+
+  frame.final = p[0] & 0x80;
+  frame.opcode = static_cast<WebSocketOpcode>(p[0] & 0x0F);
+  frame.payload.assign(data + offset, length);
+  if (masked) {
+    for (size_t i = 0; i < length; i++) {
+      frame.payload[i] ^= mask[i % 4];
+    }
+  }
+  return offset + length;
+}
+
+std::string close_frame(WebSocketError error) {
+  const uint16_t code = static_cast<uint16_t>(error);
+  return encode_frame(WebSocketOpcode::CLOSE,
+                      std::string{static_cast<char>(code >> 8), static_cast<char>(code & 0xFF)});
+}
+
+std::string encode_frame(WebSocketOpcode opcode, const std::string& payload, bool mask) {
+  std::string frame;
+  frame += static_cast<char>(0x80 | static_cast<uint8_t>(opcode));
+  const uint8_t mask_bit = mask ? 0x80 : 0;
+  const uint64_t length = payload.size();
+  if (length < 126) {
+    frame += static_cast<char>(mask_bit | length);
+  } else if (length < 65536) {
+    frame += static_cast<char>(mask_bit | 126);
+    frame += static_cast<char>(length >> 8);
+    frame += static_cast<char>(length);
+  } else {
+    frame += static_cast<char>(mask_bit | 127);
+    for (int i = 7; i >= 0; i--) {
+      frame += static_cast<char>(length >> (8 * i));
+    }
+  }
+  if (!mask) {
+    return frame + payload;
+  }
+  static std::mt19937 gen(std::random_device{}());
+  uint32_t key = gen();
+  char k[4] = {char(key), char(key >> 8), char(key >> 16), char(key >> 24)};
+  frame.append(k, 4);
+  for (size_t i = 0; i < payload.size(); i++) {
+    frame += static_cast<char>(payload[i] ^ k[i % 4]);
+  }
+  return frame;
+}
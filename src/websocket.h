@@ -0,0 +1,77 @@
+#ifndef WEBSOCKET_H
+#define WEBSOCKET_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/*
+ The parts of RFC 6455 the io_uring server and the load generator need,
+ without any I/O: the opening handshake and framing of single-frame
+ messages. Fragmented messages and extensions are not supported.
+ */
+
+enum class WebSocketOpcode : uint8_t {
+  CONTINUATION = 0x0,
+  TEXT = 0x1,
+  BINARY = 0x2,
+  CLOSE = 0x8,
+  PING = 0x9,
+  PONG = 0xA
+};
+
+struct WebSocketFrame {
+  bool final;
+  WebSocketOpcode opcode;
+  // Unmasked.
+  std::string payload;
+};
+
+// The complete HTTP request at the start of data, or 0 bytes while it is
+// incomplete.
+size_t http_request_size(const char* data, size_t size);
+
+// The 101 response to an HTTP upgrade request. False when request is not
+// one, e.g. a plain GET.
+bool websocket_accept(const std::string& request, std::string& response);
+
+// The client side: an upgrade request, and a check of the server's
+// response to it.
+std::string websocket_request(const std::string& host, const std::string& path,
+                              const std::string& key);
+bool websocket_accepted(const std::string& response, const std::string& key);
+
+// Why a connection is closed, e.g. why decode_frame() refused a frame, as
+// the status code of the close frame.
+enum class WebSocketError : uint16_t {
+  NONE = 0,
+  // Masked the wrong way for its direction.
+  PROTOCOL = 1002,
+  // Longer than the payload limit.
+  TOO_BIG = 1009,
+  // The server has no room for the connection now.
+  TRY_AGAIN_LATER = 1013
+};
+
+// The default payload limit, the same as uWS's.
+const size_t max_websocket_payload = 16 * 1024 * 1024;
+
+// Decode the frame at the start of data. Returns the bytes it takes, 0
+// while it is incomplete or when it is refused, with error set. Frames
+// from_client must be masked and frames from a server must not be (RFC
+// 6455 section 5.1), and no payload may be longer than max_payload. The
+// length is checked as soon as the header is in, before the payload is
+// buffered.
+size_t decode_frame(const char* data, size_t size, WebSocketFrame& frame, bool from_client,
+                    WebSocketError& error, size_t max_payload = max_websocket_payload);
+
+// The close frame for error.
+std::string close_frame(WebSocketError error);
+
+// A final frame; clients must mask theirs.
+std::string encode_frame(WebSocketOpcode opcode, const std::string& payload, bool mask = false);
+
+// Base64 of the SHA-1 of data.
+std::string sha1_base64(const std::string& data);
+
+#endif /* WEBSOCKET_H */